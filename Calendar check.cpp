@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <vector>
 #include <algorithm>
+#include "Metrics.h"
 
 const int k_maxDays = 1000000;
 
@@ -56,7 +57,7 @@ struct CalendarInfo
     Node m_correctionsEachNYears[ 10 ];
     Node m_correctionsYearsEndIn[ 10 ];
 
-    void ShowCalendarInfo()
+    void ShowCalendarInfo() const
     {
         printf( "\n>>Calendar Information:\n" );
         printf( "- There is a %.2f%% of years from a total of %d years that miss more than 1 day from natural translation cycle.\n", m_errorPercentage * 100.0f, k_maxDays );
@@ -168,6 +169,7 @@ struct Calendar
 
     float ApplyCorrections()
     {
+        METRICS_TIME( "calendar.apply_corrections" );
         float errorPercentage = 0.0f;
         
         int errorDays = 0;
@@ -289,6 +291,8 @@ private:
     float m_daysAsError;
     CalendarInfo m_solutions[k_maxSolutions];
     int m_currentSolutions;
+    // calendars evaluated by the last Solver
+    unsigned long long m_nodesExpanded;
     bool m_conditionsEachNYears[ k_maxConditionYear + 1 ];
     bool m_conditionsYearsEndIn[ k_maxConditionYear + 1 ];
 
@@ -298,10 +302,18 @@ public:
 
     void Solver()
     {
+        METRICS_TIME( "calendar.solver" );
+        m_nodesExpanded = 0;
         Calendar calendar( m_errorPerYear, m_daysAsError );
         SolverIteration( calendar, 0, 1.0f );
+        METRICS_ADD( "calendar.nodes_expanded", m_nodesExpanded );
     }
 
+    // best first, valid after Solver
+    int GetSolutionCount() const { return m_currentSolutions; }
+    const CalendarInfo &GetSolution( int index ) const { return m_solutions[ index ]; }
+    unsigned long long GetNodesExpanded() const { return m_nodesExpanded; }
+
     void ShowSolutions()
     {
         printf( "\n>> Solutions found: %d\n\n", m_currentSolutions );
@@ -319,6 +331,7 @@ private:
         m_errorPerYear = errorPerYear;
         m_daysAsError = daysAsError;
         m_currentSolutions = 0;
+        m_nodesExpanded = 0;
 
         for ( int i = 0; i <= k_maxConditionYear + 1; ++i )
         {
@@ -329,6 +342,7 @@ private:
 
     void SolverIteration(Calendar &calendar, int iteration, float prevErrorPercentage)
     {
+        ++m_nodesExpanded;
         CalendarInfo solution;
         calendar.ApplyCorrections();
         calendar.GetCurrentCalendarInfo( solution );
@@ -364,10 +378,12 @@ private:
             }
         }
 
+#ifndef CALENDAR_NO_MAIN
         if ( iteration == 0 )
         {
-            printf( ">> 25% completed" );
+            printf( ">> 25%% completed\n" );
         }
+#endif
 
         for ( int i = 3; i < k_maxConditionYear; ++i )
         {
@@ -382,10 +398,12 @@ private:
             }
         }
 
+#ifndef CALENDAR_NO_MAIN
         if ( iteration == 0 )
         {
-            printf( ">> 50% completed" );
+            printf( ">> 50%% completed\n" );
         }
+#endif
 
         //
 
@@ -431,7 +449,6 @@ private:
         if ( m_currentSolutions == 0 )
         {
             m_solutions[ m_currentSolutions++ ] = solution;
-            m_solutions[ 0 ].ShowCalendarInfo();
         }
         else
         {
@@ -463,11 +480,11 @@ private:
         {
             m_errorThreshold = m_solutions[ m_currentSolutions - 1 ].m_errorPercentage;
         }
-        solution.ShowCalendarInfo();
     }
 
 };
 
+#ifndef CALENDAR_NO_MAIN
 int main()
 {
     float errorPerYear = 1.73128425136941f - 2.0f;
@@ -475,7 +492,12 @@ int main()
     
     //CalendarSolver solver( errorPerYear, daysAsError );
     //solver.Solver();
-    //solver.ShowSolutions();
+    //printf( "\n>> Solutions found: %d\n\n", solver.GetSolutionCount() );
+    //for ( int i = 0; i < solver.GetSolutionCount(); ++i )
+    //{
+    //    printf( ">> Solution %d\n", i + 1 );
+    //    solver.GetSolution( i ).ShowCalendarInfo();
+    //}
 
     Calendar calendar( errorPerYear, daysAsError );
 
@@ -495,4 +517,5 @@ int main()
     system( "pause" );
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+#ifndef INPUT_READER_H
+#define INPUT_READER_H
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+
+// Reads the game input from a file descriptor in large blocks and parses it
+// in place: numbers are converted straight from the buffer and lines are
+// handed out as views into it, so a map is never copied. Blank lines, '\r'
+// and runs of spaces or tabs are accepted wherever a separator is.
+//
+// Only what the caller asks for is waited on, so it works on the game's
+// pipe: a read never blocks on input of the next turn.
+class InputReader
+{
+public:
+
+    static const size_t k_blockSize = 1 << 16;
+
+    InputReader( int fd = 0 ) : m_fd( fd ), m_begin( 0 ), m_end( 0 ), m_eof( false )
+    {
+        m_buffer.resize( k_blockSize );
+    }
+
+    // false at the end of the input or when the next token isn't a number
+    bool ReadInt( int &value )
+    {
+        if ( !SkipSpaces() ) return false;
+
+        bool negative = m_buffer[ m_begin ] == '-';
+        if ( negative || m_buffer[ m_begin ] == '+' )
+        {
+            ++m_begin;
+            if ( m_begin == m_end && !Fill() ) return false;
+        }
+        if ( !IsDigit( m_buffer[ m_begin ] ) ) return false;
+
+        int result = 0;
+        do
+        {
+            while ( m_begin < m_end && IsDigit( m_buffer[ m_begin ] ) )
+            {
+                result = result * 10 + ( m_buffer[ m_begin++ ] - '0' );
+            }
+        }
+        while ( m_begin == m_end && Fill() );
+        value = negative ? -result : result;
+        return true;
+    }
+
+    // Skips blank lines, then reads count lines and packs them where they
+    // are, each one without its surrounding spaces and followed by a single
+    // '\n'. The views stay valid until the next call
+    bool ReadLines( int count, const char **lines, int *lengths )
+    {
+        m_offsets.resize( count );
+        // both relative to m_begin, which Fill may move
+        size_t in = 0;
+        size_t out = 0;
+        for ( int i = 0; i < count; )
+        {
+            const char *newLine = 0;
+            while ( ( newLine = ( const char * ) std::memchr( m_buffer.data() + m_begin + in, '\n', m_end - m_begin - in ) ) == 0 )
+            {
+                if ( !Fill() ) return false;
+            }
+            size_t start = in;
+            size_t end = newLine - ( m_buffer.data() + m_begin );
+            in = end + 1;
+            while ( start < end && IsSpace( m_buffer[ m_begin + start ] ) ) ++start;
+            while ( end > start && IsSpace( m_buffer[ m_begin + end - 1 ] ) ) --end;
+            if ( start == end ) continue;
+
+            // lines already in shape don't move at all
+            if ( i == 0 ) out = start;
+            if ( out != start ) std::memmove( &m_buffer[ m_begin + out ], &m_buffer[ m_begin + start ], end - start );
+            m_offsets[ i ] = out;
+            lengths[ i ] = ( int ) ( end - start );
+            out += end - start;
+            m_buffer[ m_begin + out++ ] = '\n';
+            ++i;
+        }
+        for ( int i = 0; i < count; ++i ) lines[ i ] = &m_buffer[ m_begin + m_offsets[ i ] ];
+        m_begin += in;
+        return true;
+    }
+
+    // A grid of rows lines of columns cells, laid out as rows * ( columns
+    // + 1 ) bytes with a '\n' after each row. 0 when the input ends or a row
+    // has another width
+    const char *ReadRows( int rows, int columns )
+    {
+        m_lines.resize( rows );
+        m_lengths.resize( rows );
+        if ( rows == 0 || !ReadLines( rows, &m_lines[ 0 ], &m_lengths[ 0 ] ) ) return 0;
+        for ( int i = 0; i < rows; ++i )
+        {
+            if ( m_lengths[ i ] != columns ) return 0;
+        }
+        return m_lines[ 0 ];
+    }
+
+private:
+
+    static bool IsDigit( char c ) { return c >= '0' && c <= '9'; }
+    static bool IsSpace( char c ) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    bool SkipSpaces()
+    {
+        do
+        {
+            while ( m_begin < m_end && IsSpace( m_buffer[ m_begin ] ) ) ++m_begin;
+            if ( m_begin < m_end ) return true;
+        }
+        while ( Fill() );
+        return false;
+    }
+
+    // Appends the next block to the unread bytes. What was read is dropped
+    // while little is left to move, so a map starts near the front and is
+    // moved at most once; the buffer only grows for a map that doesn't fit.
+    // The last line gets a '\n' if the input doesn't end with one
+    bool Fill()
+    {
+        if ( m_eof ) return false;
+        if ( m_begin > 0 && ( m_end - m_begin <= k_blockSize || m_end == m_buffer.size() ) )
+        {
+            std::memmove( &m_buffer[ 0 ], &m_buffer[ m_begin ], m_end - m_begin );
+            m_end -= m_begin;
+            m_begin = 0;
+        }
+        if ( m_end == m_buffer.size() ) m_buffer.resize( m_buffer.size() * 2 );
+
+        ssize_t bytes;
+        do
+        {
+            bytes = read( m_fd, &m_buffer[ m_end ], std::min( m_buffer.size() - m_end, ( size_t ) k_blockSize ) );
+        }
+        while ( bytes < 0 && errno == EINTR );
+
+        if ( bytes > 0 )
+        {
+            m_end += bytes;
+            return true;
+        }
+        m_eof = true;
+        if ( m_end > m_begin && m_buffer[ m_end - 1 ] != '\n' )
+        {
+            m_buffer[ m_end++ ] = '\n';
+            return true;
+        }
+        return false;
+    }
+
+    int m_fd;
+    std::vector<char> m_buffer;
+    size_t m_begin;
+    size_t m_end;
+    bool m_eof;
+    std::vector<size_t> m_offsets;
+    std::vector<const char *> m_lines;
+    std::vector<int> m_lengths;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,280 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+// Latency histograms per call type and work counters. Build with -DMETRICS=0
+// and every METRICS_* macro expands to nothing.
+//
+// A summary goes to stderr when the program exits. With METRICS_JSON set to
+// a file name ("-" for stderr), one JSON line with every histogram and counter
+// is also written every METRICS_EVERY game turns (1 by default).
+//
+// -DMETRICS_ALLOCATIONS=1 counts every operator new in the "allocations"
+// counter. It replaces the global operator new, so only one translation unit
+// of a program may build with it.
+#ifndef METRICS
+#define METRICS 1
+#endif
+
+#ifndef METRICS_ALLOCATIONS
+#define METRICS_ALLOCATIONS 0
+#endif
+
+// Log-linear buckets as in HdrHistogram: values below 2^k_subBits have a
+// bucket each, and every power of two above is split in 2^k_subBits buckets,
+// so a recorded value is off by less than 1 / 2^k_subBits (3%)
+class LatencyHistogram
+{
+public:
+
+    static const int k_subBits = 5;
+    static const int k_buckets = ( 64 - k_subBits + 1 ) << k_subBits;
+
+    LatencyHistogram() : m_count( 0 ), m_sum( 0 ), m_max( 0 )
+    {
+        for ( int i = 0; i < k_buckets; ++i ) m_counts[ i ].store( 0, std::memory_order_relaxed );
+    }
+
+    void Record( unsigned long long ns )
+    {
+        m_counts[ Index( ns ) ].fetch_add( 1, std::memory_order_relaxed );
+        m_count.fetch_add( 1, std::memory_order_relaxed );
+        m_sum.fetch_add( ns, std::memory_order_relaxed );
+        unsigned long long max = m_max.load( std::memory_order_relaxed );
+        while ( ns > max && !m_max.compare_exchange_weak( max, ns, std::memory_order_relaxed ) ) {}
+    }
+
+    unsigned long long GetCount() const { return m_count.load( std::memory_order_relaxed ); }
+    unsigned long long GetMax() const { return m_max.load( std::memory_order_relaxed ); }
+    double GetMean() const { return GetCount() ? ( double ) m_sum.load( std::memory_order_relaxed ) / GetCount() : 0.0; }
+
+    // middle of the bucket holding the value at p (0 to 1)
+    double GetPercentile( double p ) const
+    {
+        unsigned long long count = GetCount();
+        if ( count == 0 ) return 0.0;
+        // nearest rank
+        unsigned long long rank = std::max( 1ULL, ( unsigned long long ) std::ceil( p * count ) );
+        unsigned long long seen = 0;
+        for ( int i = 0; i < k_buckets; ++i )
+        {
+            seen += m_counts[ i ].load( std::memory_order_relaxed );
+            if ( seen >= rank ) return std::min( ( double ) GetMax(), Lowest( i ) + ( Width( i ) - 1 ) / 2.0 );
+        }
+        return ( double ) GetMax();
+    }
+
+private:
+
+    static int Index( unsigned long long value )
+    {
+        if ( value < ( 1ULL << k_subBits ) ) return ( int ) value;
+        int shift = 63 - __builtin_clzll( value ) - k_subBits;
+        return ( ( shift + 1 ) << k_subBits ) + ( int ) ( ( value >> shift ) - ( 1ULL << k_subBits ) );
+    }
+    static double Lowest( int index )
+    {
+        if ( index < ( 1 << k_subBits ) ) return index;
+        int shift = ( index >> k_subBits ) - 1;
+        return ( double ) ( ( ( 1ULL << k_subBits ) + ( index & ( ( 1 << k_subBits ) - 1 ) ) ) << shift );
+    }
+    static double Width( int index ) { return index < ( 1 << k_subBits ) ? 1.0 : ( double ) ( 1ULL << ( ( index >> k_subBits ) - 1 ) ); }
+
+    std::atomic<unsigned long long> m_counts[ k_buckets ];
+    std::atomic<unsigned long long> m_count;
+    std::atomic<unsigned long long> m_sum;
+    std::atomic<unsigned long long> m_max;
+};
+
+class MetricsCounter
+{
+public:
+
+    MetricsCounter() : m_value( 0 ) {}
+
+    void Add( unsigned long long value ) { m_value.fetch_add( value, std::memory_order_relaxed ); }
+    unsigned long long Get() const { return m_value.load( std::memory_order_relaxed ); }
+
+private:
+
+    std::atomic<unsigned long long> m_value;
+};
+
+// set apart so that counting an allocation never allocates
+inline MetricsCounter &GetAllocationCounter()
+{
+    static MetricsCounter counter;
+    return counter;
+}
+
+// Records the time from construction to destruction
+class ScopedTimer
+{
+public:
+
+    ScopedTimer( LatencyHistogram &histogram ) : m_histogram( histogram ), m_start( std::chrono::steady_clock::now() ) {}
+    ~ScopedTimer()
+    {
+        m_histogram.Record( ( unsigned long long ) std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - m_start ).count() );
+    }
+
+private:
+
+    LatencyHistogram &m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Every histogram and counter by name. Call sites look theirs up once and
+// keep the reference, so recording never goes through here
+class Metrics
+{
+public:
+
+    static const int k_maxMetrics = 32;
+
+    // never destroyed, the summary is written at exit
+    static Metrics &Get()
+    {
+        static Metrics *metrics = new Metrics();
+        return *metrics;
+    }
+
+    LatencyHistogram &GetHistogram( const char *name ) { return *Find( name, m_histogramNames, m_histograms, m_nHistograms ); }
+    MetricsCounter &GetCounter( const char *name ) { return *Find( name, m_counterNames, m_counters, m_nCounters ); }
+
+    // once per game turn, writes the JSON line when it is due
+    void Tick()
+    {
+        ++m_ticks;
+        if ( m_json && m_ticks % m_every == 0 ) WriteJson( m_json );
+    }
+
+    void WriteSummary( FILE *file )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( m_nHistograms + m_nCounters == 0 ) return;
+        if ( m_ticks ) fprintf( file, "## Metrics (%llu turns)\n", m_ticks );
+        else fprintf( file, "## Metrics\n" );
+        for ( int i = 0; i < m_nHistograms; ++i )
+        {
+            const LatencyHistogram &histogram = *m_histograms[ i ];
+            if ( histogram.GetCount() == 0 ) continue;
+            fprintf( file, "%-36s %8llu calls, mean %9.1f us, p50 %9.1f us, p90 %9.1f us, p99 %9.1f us, max %9.1f us\n",
+                m_histogramNames[ i ], histogram.GetCount(), histogram.GetMean() / 1000.0, histogram.GetPercentile( 0.5 ) / 1000.0,
+                histogram.GetPercentile( 0.9 ) / 1000.0, histogram.GetPercentile( 0.99 ) / 1000.0, histogram.GetMax() / 1000.0 );
+        }
+        for ( int i = 0; i < m_nCounters; ++i ) fprintf( file, "%-36s %llu\n", m_counterNames[ i ], m_counters[ i ]->Get() );
+        fprintf( file, "##\n" );
+    }
+
+    void WriteJson( FILE *file )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        fprintf( file, "{\"turn\":%llu,\"latency_ns\":{", m_ticks );
+        for ( int i = 0; i < m_nHistograms; ++i )
+        {
+            const LatencyHistogram &histogram = *m_histograms[ i ];
+            fprintf( file, "%s\"%s\":{\"count\":%llu,\"mean\":%.0f,\"p50\":%.0f,\"p90\":%.0f,\"p99\":%.0f,\"max\":%llu}",
+                i ? "," : "", m_histogramNames[ i ], histogram.GetCount(), histogram.GetMean(), histogram.GetPercentile( 0.5 ),
+                histogram.GetPercentile( 0.9 ), histogram.GetPercentile( 0.99 ), histogram.GetMax() );
+        }
+        fprintf( file, "},\"counters\":{" );
+        for ( int i = 0; i < m_nCounters; ++i ) fprintf( file, "%s\"%s\":%llu", i ? "," : "", m_counterNames[ i ], m_counters[ i ]->Get() );
+        fprintf( file, "}}\n" );
+        fflush( file );
+    }
+
+private:
+
+    Metrics() : m_nHistograms( 0 ), m_nCounters( 0 ), m_ticks( 0 ), m_json( 0 ), m_every( 1 )
+    {
+        const char *json = getenv( "METRICS_JSON" );
+        if ( json ) m_json = std::strcmp( json, "-" ) == 0 ? stderr : fopen( json, "a" );
+        const char *every = getenv( "METRICS_EVERY" );
+        if ( every && atoi( every ) > 0 ) m_every = atoi( every );
+#if METRICS_ALLOCATIONS
+        m_counterNames[ m_nCounters ] = "allocations";
+        m_counters[ m_nCounters++ ] = &GetAllocationCounter();
+#endif
+        atexit( AtExit );
+    }
+
+    static void AtExit()
+    {
+        Metrics &metrics = Get();
+        metrics.WriteSummary( stderr );
+        if ( metrics.m_json && metrics.m_json != stderr ) fclose( metrics.m_json );
+    }
+
+    // unknown names are added while there is room, later ones share the last slot
+    template <typename T>
+    T *Find( const char *name, const char **names, T **metrics, int &count )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        for ( int i = 0; i < count; ++i )
+        {
+            if ( std::strcmp( names[ i ], name ) == 0 ) return metrics[ i ];
+        }
+        if ( count == k_maxMetrics ) return metrics[ count - 1 ];
+        names[ count ] = name;
+        metrics[ count ] = new T();
+        return metrics[ count++ ];
+    }
+
+    std::mutex m_mutex;
+    const char *m_histogramNames[ k_maxMetrics ];
+    LatencyHistogram *m_histograms[ k_maxMetrics ];
+    int m_nHistograms;
+    const char *m_counterNames[ k_maxMetrics ];
+    MetricsCounter *m_counters[ k_maxMetrics ];
+    int m_nCounters;
+    unsigned long long m_ticks;
+    FILE *m_json;
+    int m_every;
+};
+
+#define METRICS_CONCAT_( a, b ) a##b
+#define METRICS_CONCAT( a, b ) METRICS_CONCAT_( a, b )
+
+#if METRICS
+// times the rest of the enclosing scope
+#define METRICS_TIME( name ) \
+    static LatencyHistogram &METRICS_CONCAT( metricsHistogram, __LINE__ ) = Metrics::Get().GetHistogram( name ); \
+    ScopedTimer METRICS_CONCAT( metricsTimer, __LINE__ )( METRICS_CONCAT( metricsHistogram, __LINE__ ) )
+#define METRICS_ADD( name, value ) \
+    do \
+    { \
+        static MetricsCounter &counter = Metrics::Get().GetCounter( name ); \
+        counter.Add( value ); \
+    } while ( 0 )
+#define METRICS_TICK() Metrics::Get().Tick()
+#else
+#define METRICS_TIME( name )
+#define METRICS_ADD( name, value ) ( ( void ) 0 )
+#define METRICS_TICK() ( ( void ) 0 )
+#endif
+
+#if METRICS && METRICS_ALLOCATIONS
+#include <new>
+
+// not inlined, or GCC pairs the malloc and free below against new and delete
+__attribute__( ( noinline ) ) void *operator new( size_t size )
+{
+    GetAllocationCounter().Add( 1 );
+    void *p = std::malloc( size ? size : 1 );
+    if ( p == 0 ) throw std::bad_alloc();
+    return p;
+}
+__attribute__( ( noinline ) ) void operator delete( void *p ) noexcept { std::free( p ); }
+__attribute__( ( noinline ) ) void operator delete( void *p, size_t ) noexcept { std::free( p ); }
+#endif
+
+#endif
\ No newline at end of file
@@ -1,67 +1,159 @@
 #include <cstdio>
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "InputReader.h"
+#include "Metrics.h"
 
 // https://www.codingame.com/training/hard/skynet-revolution-episode-2
 
-struct Node
+// Binary snapshot of a network: this header followed by the CSR offsets
+// (nodes + 1 ints), the neighbour lists (2 * links ints), one alive flag per
+// half edge and one gateway flag per node. Every section can be used in place
+// once the file is mapped, so loading a snapshot does not parse anything.
+struct SnapshotHeader
 {
-    Node( int N ) : m_isGateway( false ), m_edges( 0 )
-    {
-        m_edges = new bool[ N ];
-        for ( int i = 0; i < N; ++i ) m_edges[ i ] = false;
-    }
-    ~Node() { delete[] m_edges; }
-    void SetGateway() { m_isGateway = true; }
-    void AddEdge( int node )
-    {
-        m_edges[ node ] = true;
-    }
-    void RemoveEdge( int node )
-    {
-        m_edges[ node ] = false;
-    }
-
-    bool *m_edges;
-    bool m_isGateway;
+    char m_magic[ 8 ];
+    int m_nodes;
+    int m_links;
 };
 
+const char k_snapshotMagic[ 8 ] = { 'S', 'K', 'Y', 'N', 'E', 'T', 0, 1 };
+
 class Network
 {
 public:
 
-    Network( int size )
-        : m_size( size ), m_nodes( 0 ), m_visited( 0 )
+    Network( int size, const std::vector< std::pair<int, int> > &links )
+        : m_size( size ), m_links( ( int ) links.size() ), m_data( 0 ), m_dataSize( 0 ), m_mapped( false ), m_visited( 0 ), m_deep( 0 ), m_agents( 0 )
+        , m_nodesExpanded( 0 ), m_queuePushes( 0 ), m_reportedNodes( 0 ), m_reportedPushes( 0 )
     {
-        m_nodes = new Node *[ m_size ];
-        for ( int i = 0; i < m_size; ++i ) m_nodes[ i ] = new Node( m_size );
-        m_visited = new bool[ m_size ];
-        for ( int i = 0; i < m_size; ++i ) m_visited[ i ] = false;
+        m_dataSize = SnapshotSize( m_size, m_links );
+        m_data = new char[ m_dataSize ];
+        SnapshotHeader *header = ( SnapshotHeader * ) m_data;
+        std::memcpy( header->m_magic, k_snapshotMagic, sizeof( k_snapshotMagic ) );
+        header->m_nodes = m_size;
+        header->m_links = m_links;
+        Attach();
+
+        for ( int i = 0; i <= m_size; ++i ) m_offsets[ i ] = 0;
+        for ( int i = 0; i < m_links; ++i )
+        {
+            m_offsets[ links[ i ].first + 1 ]++;
+            m_offsets[ links[ i ].second + 1 ]++;
+        }
+        for ( int i = 0; i < m_size; ++i ) m_offsets[ i + 1 ] += m_offsets[ i ];
+
+        std::vector<int> cursor( m_offsets, m_offsets + m_size );
+        for ( int i = 0; i < m_links; ++i )
+        {
+            m_targets[ cursor[ links[ i ].first ]++ ] = links[ i ].second;
+            m_targets[ cursor[ links[ i ].second ]++ ] = links[ i ].first;
+        }
+
+        // neighbours are kept sorted so they are visited in node order, and
+        // repeated links are stored only once
+        for ( int i = 0; i < m_size; ++i )
+        {
+            std::sort( &m_targets[ m_offsets[ i ] ], &m_targets[ m_offsets[ i + 1 ] ] );
+            for ( int e = m_offsets[ i ]; e < m_offsets[ i + 1 ]; ++e )
+            {
+                m_alive[ e ] = e == m_offsets[ i ] || m_targets[ e ] != m_targets[ e - 1 ];
+            }
+        }
+        for ( int i = 0; i < m_size; ++i ) m_isGateway[ i ] = false;
     }
-    ~Network()
+
+    Network( const char *snapshotPath )
+        : m_size( 0 ), m_links( 0 ), m_data( 0 ), m_dataSize( 0 ), m_mapped( true ), m_visited( 0 ), m_deep( 0 ), m_agents( 0 )
+        , m_nodesExpanded( 0 ), m_queuePushes( 0 ), m_reportedNodes( 0 ), m_reportedPushes( 0 )
     {
-        for ( int i = 0; i < m_size; ++i ) delete m_nodes[ i ];
-        delete[] m_nodes;
-        delete[] m_visited;
+        int fd = open( snapshotPath, O_RDONLY );
+        if ( fd < 0 ) return;
+
+        struct stat info;
+        if ( fstat( fd, &info ) == 0 && ( size_t ) info.st_size >= sizeof( SnapshotHeader ) )
+        {
+            // private mapping: removed edges are written to our own copy of the pages
+            void *data = mmap( 0, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+            if ( data != MAP_FAILED )
+            {
+                m_data = ( char * ) data;
+                m_dataSize = info.st_size;
+            }
+        }
+        close( fd );
+
+        if ( m_data == 0 ) return;
+
+        const SnapshotHeader *header = ( const SnapshotHeader * ) m_data;
+        if ( std::memcmp( header->m_magic, k_snapshotMagic, sizeof( k_snapshotMagic ) ) != 0
+            || header->m_nodes < 0 || header->m_links < 0
+            || SnapshotSize( header->m_nodes, header->m_links ) != m_dataSize
+            || !IsValidGraph( m_data, header->m_nodes, header->m_links ) )
+        {
+            munmap( m_data, m_dataSize );
+            m_data = 0;
+            return;
+        }
+
+        m_size = header->m_nodes;
+        m_links = header->m_links;
+        Attach();
     }
 
-    void AddEdge( int node1, int node2 )
+    ~Network()
     {
-        m_nodes[ node1 ]->AddEdge( node2 );
-        m_nodes[ node2 ]->AddEdge( node1 );
+        if ( m_mapped )
+        {
+            if ( m_data ) munmap( m_data, m_dataSize );
+        }
+        else
+        {
+            delete[] m_data;
+        }
+        delete[] m_visited;
+        delete[] m_deep;
+        delete[] m_agents;
     }
 
+    bool IsLoaded() const { return m_data != 0; }
+
     void RemoveEdge( int node1, int node2 )
     {
-        m_nodes[ node1 ]->RemoveEdge( node2 );
-        m_nodes[ node2 ]->RemoveEdge( node1 );
-
-        printf( "%d %d\n", node1, node2 );
+        KillEdge( node1, node2 );
+        KillEdge( node2, node1 );
     }
 
-    void SetGateway( int node ) { m_nodes[ node ]->SetGateway(); }
+    void SetGateway( int node ) { m_isGateway[ node ] = true; }
+
+    std::pair<int, int> BlockBestPath( int start ) { return BlockBestPath( &start, 1 ); }
+
+    // Cuts the single most urgent link for several agents at once, using
+    // one BFS shared by all of them (at most k_maxAgents are considered).
+    // Returns the link cut, which the caller reports to the game
+    std::pair<int, int> BlockBestPath( const int *agents, int nAgents );
+
+    static const int k_maxAgents = 64;
 
-    void BlockBestPath( int start );
+    // totals over every BlockBestPath so far
+    unsigned long long GetNodesExpanded() const { return m_nodesExpanded; }
+    unsigned long long GetQueuePushes() const { return m_queuePushes; }
+
+    bool SaveSnapshot( const char *path ) const
+    {
+        FILE *file = fopen( path, "wb" );
+        if ( file == 0 ) return false;
+        bool ok = fwrite( m_data, sizeof( char ), m_dataSize, file ) == m_dataSize;
+        return fclose( file ) == 0 && ok;
+    }
 
 private:
 
@@ -72,39 +164,127 @@ private:
         int cost;
     };
 
+    static size_t SnapshotSize( int size, int links )
+    {
+        return sizeof( SnapshotHeader )
+            + sizeof( int ) * ( ( size_t ) size + 1 )
+            + sizeof( int ) * 2 * ( size_t ) links
+            + sizeof( char ) * 2 * ( size_t ) links
+            + sizeof( char ) * ( size_t ) size;
+    }
+
+    // The search trusts the CSR arrays: offsets must go from 0 to 2 * links
+    // without decreasing and every target must be a node
+    static bool IsValidGraph( const char *data, int size, int links )
+    {
+        const int *offsets = ( const int * ) ( data + sizeof( SnapshotHeader ) );
+        const int *targets = offsets + size + 1;
+        if ( offsets[ 0 ] != 0 || offsets[ size ] != 2 * links ) return false;
+        for ( int i = 0; i < size; ++i )
+        {
+            if ( offsets[ i + 1 ] < offsets[ i ] ) return false;
+        }
+        for ( int e = 0; e < 2 * links; ++e )
+        {
+            if ( targets[ e ] < 0 || targets[ e ] >= size ) return false;
+        }
+        return true;
+    }
+
+    void Attach()
+    {
+        m_offsets = ( int * ) ( m_data + sizeof( SnapshotHeader ) );
+        m_targets = m_offsets + m_size + 1;
+        m_alive = ( char * ) ( m_targets + 2 * m_links );
+        m_isGateway = m_alive + 2 * m_links;
+
+        m_visited = new bool[ m_size ];
+        for ( int i = 0; i < m_size; ++i ) m_visited[ i ] = false;
+        m_deep = new int[ m_size ];
+        m_agents = new unsigned long long[ m_size ];
+    }
+
+    void KillEdge( int from, int to )
+    {
+        for ( int e = m_offsets[ from ]; e < m_offsets[ from + 1 ]; ++e )
+        {
+            if ( m_targets[ e ] == to ) m_alive[ e ] = false;
+        }
+    }
+
     int m_size;
-    Node **m_nodes;
+    int m_links;
+    char *m_data;
+    size_t m_dataSize;
+    bool m_mapped;
+    int *m_offsets;
+    int *m_targets;
+    char *m_alive;
+    char *m_isGateway;
     bool *m_visited;
+    int *m_deep;
+    unsigned long long *m_agents;
+    unsigned long long m_nodesExpanded;
+    unsigned long long m_queuePushes;
+    // totals already added to the metrics counters
+    unsigned long long m_reportedNodes;
+    unsigned long long m_reportedPushes;
 };
 
-void Network::BlockBestPath( int start )
+std::pair<int, int> Network::BlockBestPath( const int *agents, int nAgents )
 {
+    METRICS_TIME( "skynet.block_best_path" );
     std::pair<int, int> edgeToRemove( -1, -1 );
+    if ( nAgents > k_maxAgents ) nAgents = k_maxAgents;
     for ( int i = 0; i < m_size; ++i )
     {
         m_visited[ i ] = false;
     }
-    m_visited[ start ] = true;
+    for ( int a = 0; a < nAgents; ++a )
+    {
+        m_visited[ agents[ a ] ] = true;
+        m_deep[ agents[ a ] ] = -1;
+    }
 
-    std::queue<PathNode> nodes;
-    PathNode pathNode;
-    bool *edges = m_nodes[ start ]->m_edges;
-    for ( int i = 0; i < m_size; ++i )
+    // an agent next to a gateway is always the most urgent threat
+    for ( int a = 0; a < nAgents; ++a )
     {
-        if ( edges[ i ] )
+        int start = agents[ a ];
+        for ( int e = m_offsets[ start ]; e < m_offsets[ start + 1 ]; ++e )
         {
-            if ( m_nodes[ i ]->m_isGateway )
+            if ( m_alive[ e ] && m_isGateway[ m_targets[ e ] ] )
             {
-                RemoveEdge( start, i );
-                return;
+                RemoveEdge( start, m_targets[ e ] );
+                return std::pair<int, int>( start, m_targets[ e ] );
             }
-            else
+        }
+    }
+
+    // every agent is a source of the same BFS; a node reached by several
+    // agents at the same depth keeps the bits of all of them
+    std::queue<PathNode> nodes;
+    PathNode pathNode;
+    for ( int a = 0; a < nAgents; ++a )
+    {
+        int start = agents[ a ];
+        for ( int e = m_offsets[ start ]; e < m_offsets[ start + 1 ]; ++e )
+        {
+            int i = m_targets[ e ];
+            if ( !m_alive[ e ] ) continue;
+            if ( !m_visited[ i ] )
             {
                 pathNode.node = i;
                 pathNode.deep = 0;
                 pathNode.cost = 0;
                 nodes.push( pathNode );
+                ++m_queuePushes;
                 m_visited[ i ] = true;
+                m_deep[ i ] = 0;
+                m_agents[ i ] = 1ULL << a;
+            }
+            else if ( m_deep[ i ] == 0 )
+            {
+                m_agents[ i ] |= 1ULL << a;
             }
         }
     }
@@ -112,17 +292,19 @@ void Network::BlockBestPath( int start )
     bool stop = false;
     bool doubleFound = false;
     int moves = m_size;
+    int threatened = 0;
     while ( !nodes.empty() && !stop )
     {
         const PathNode node = nodes.front();
         nodes.pop();
+        ++m_nodesExpanded;
         int n = node.node;
-        edges = m_nodes[ n ]->m_edges;
         int ngateways = 0;
         int edge = -1;
-        for ( int i = 0; i < m_size; ++i )
+        for ( int e = m_offsets[ n ]; e < m_offsets[ n + 1 ]; ++e )
         {
-            if ( edges[ i ] && m_nodes[ i ]->m_isGateway )
+            int i = m_targets[ e ];
+            if ( m_alive[ e ] && m_isGateway[ i ] )
             {
                 ngateways++;
                 edge = i;
@@ -132,58 +314,129 @@ void Network::BlockBestPath( int start )
         int deep = node.deep + 1;
         int cost = node.cost + ngateways;
         int diff = deep - cost;
+        int agentsHere = ( int ) std::bitset<k_maxAgents>( m_agents[ n ] ).count();
 
-        if ( diff < moves && edge > 0 )
+        // ties on slack are broken by the number of agents that share it
+        if ( ( diff < moves || ( diff == moves && agentsHere > threatened ) ) && edge > 0 )
         {
             moves = diff;
+            threatened = agentsHere;
             edgeToRemove.first = n;
             edgeToRemove.second = edge;
         }
-        for ( int i = 0; i < m_size; ++i )
+        for ( int e = m_offsets[ n ]; e < m_offsets[ n + 1 ]; ++e )
         {
-            if ( edges[ i ] && !m_nodes[ i ]->m_isGateway && !m_visited[ i ] )
+            int i = m_targets[ e ];
+            if ( !m_alive[ e ] || m_isGateway[ i ] ) continue;
+            if ( !m_visited[ i ] )
             {
                 m_visited[ i ] = true;
+                m_deep[ i ] = deep;
+                m_agents[ i ] = m_agents[ n ];
                 pathNode.node = i;
                 pathNode.deep = deep;
                 pathNode.cost = cost;
                 nodes.push( pathNode );
+                ++m_queuePushes;
+            }
+            else if ( m_deep[ i ] == deep )
+            {
+                m_agents[ i ] |= m_agents[ n ];
             }
         }
 
     }
 
+    METRICS_ADD( "skynet.nodes_expanded", m_nodesExpanded - m_reportedNodes );
+    METRICS_ADD( "skynet.queue_pushes", m_queuePushes - m_reportedPushes );
+    m_reportedNodes = m_nodesExpanded;
+    m_reportedPushes = m_queuePushes;
+
     RemoveEdge( edgeToRemove.first, edgeToRemove.second );
-    return;
+    return edgeToRemove;
 }
 
-int main()
+// Usage:
+//   "Skynet Revolution"                    plays reading the network from stdin
+//   "Skynet Revolution" --convert <file>   reads the network from stdin and
+//                                          stores it as a binary snapshot
+//   "Skynet Revolution" --snapshot <file>  maps the snapshot and only reads
+//                                          the agent positions from stdin
+//   "Skynet Revolution" --agents <K>       reads K agent positions per turn
+#ifndef SKYNET_NO_MAIN
+int main( int argc, char **argv )
 {
-    int N;
-    int L;
-    int E;
-    scanf( "%d%d%d", &N, &L, &E );
-
-    Network network( N );
+    const char *convertPath = 0;
+    const char *snapshotPath = 0;
+    int nAgents = 1;
+    for ( int i = 1; i + 1 < argc; i += 2 )
+    {
+        if ( std::strcmp( argv[ i ], "--convert" ) == 0 ) convertPath = argv[ i + 1 ];
+        else if ( std::strcmp( argv[ i ], "--snapshot" ) == 0 ) snapshotPath = argv[ i + 1 ];
+        else if ( std::strcmp( argv[ i ], "--agents" ) == 0 ) nAgents = std::atoi( argv[ i + 1 ] );
+    }
+    nAgents = std::min( std::max( nAgents, 1 ), ( int ) Network::k_maxAgents );
 
-    for ( int i = 0; i < L; i++ )
+    InputReader input;
+    Network *network = 0;
+    if ( snapshotPath )
     {
-        int N1;
-        int N2;
-        scanf( "%d%d", &N1, &N2 );
-        network.AddEdge( N1, N2 );
+        network = new Network( snapshotPath );
+        if ( !network->IsLoaded() )
+        {
+            fprintf( stderr, "Invalid snapshot: %s\n", snapshotPath );
+            delete network;
+            return 1;
+        }
     }
-    for ( int i = 0; i < E; i++ )
+    else
     {
-        int EI;
-        scanf( "%d", &EI );
-        network.SetGateway( EI );
+        int N;
+        int L;
+        int E;
+        if ( !input.ReadInt( N ) || !input.ReadInt( L ) || !input.ReadInt( E ) ) return 1;
+
+        std::vector< std::pair<int, int> > links( L );
+        for ( int i = 0; i < L; i++ )
+        {
+            if ( !input.ReadInt( links[ i ].first ) || !input.ReadInt( links[ i ].second ) ) return 1;
+        }
+        network = new Network( N, links );
+
+        for ( int i = 0; i < E; i++ )
+        {
+            int EI;
+            if ( !input.ReadInt( EI ) )
+            {
+                delete network;
+                return 1;
+            }
+            network->SetGateway( EI );
+        }
     }
 
+    if ( convertPath )
+    {
+        bool saved = network->SaveSnapshot( convertPath );
+        delete network;
+        return saved ? 0 : 1;
+    }
+
+    std::vector<int> agents( nAgents );
     while ( 1 )
     {
-        int SI;
-        scanf( "%d", &SI );
-        network.BlockBestPath( SI );
+        for ( int i = 0; i < nAgents; ++i )
+        {
+            if ( !input.ReadInt( agents[ i ] ) )
+            {
+                delete network;
+                return 0;
+            }
+        }
+        std::pair<int, int> link = network->BlockBestPath( &agents[ 0 ], nAgents );
+        printf( "%d %d\n", link.first, link.second );
+        fflush( stdout );
+        METRICS_TICK();
     }
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,329 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+// traces are kept in memory only, stderr would dominate the timings
+#define TRACE_ECHO 0
+#define BRIDGE_NO_MAIN
+#include "The Bridge.cpp"
+
+// Offline referee for The Bridge: plays IA against generated maps without
+// the game server and reports how the planner behaves.
+// Build: g++ -O2 -pthread "The Bridge Referee.cpp"
+
+struct BridgeMap
+{
+    int m_nMotorbikes;
+    int m_nMotorbikesNeeded;
+    std::string m_lanes[ 4 ];
+    int m_startLanes[ 4 ];
+};
+
+class MapGenerator
+{
+public:
+
+    MapGenerator( unsigned int seed ) : m_random( seed ) {}
+
+    // holeDensity is the chance of a hole run starting at a given cell of a
+    // lane; runs are 1 to 3 cells long and the first and last cells are safe
+    BridgeMap Generate( int length, float holeDensity, int nMotorbikes, int nMotorbikesNeeded )
+    {
+        BridgeMap map;
+        map.m_nMotorbikes = nMotorbikes;
+        map.m_nMotorbikesNeeded = nMotorbikesNeeded;
+
+        std::uniform_real_distribution<float> chance( 0.0f, 1.0f );
+        std::uniform_int_distribution<int> run( 1, 3 );
+        for ( int lane = 0; lane < 4; ++lane )
+        {
+            std::string &cells = map.m_lanes[ lane ];
+            cells.assign( length, '.' );
+            for ( int x = k_safeStart; x < length - 1; ++x )
+            {
+                if ( chance( m_random ) < holeDensity )
+                {
+                    int end = std::min( x + run( m_random ), length - 1 );
+                    for ( ; x < end; ++x ) cells[ x ] = '0';
+                }
+            }
+        }
+
+        int lanes[ 4 ] = { 0, 1, 2, 3 };
+        std::shuffle( lanes, lanes + 4, m_random );
+        bool picked[ 4 ] = { false, false, false, false };
+        for ( int i = 0; i < nMotorbikes; ++i ) picked[ lanes[ i ] ] = true;
+        for ( int lane = 0, i = 0; lane < 4; ++lane )
+        {
+            if ( picked[ lane ] ) map.m_startLanes[ i++ ] = lane;
+        }
+
+        return map;
+    }
+
+private:
+
+    static const int k_safeStart = 4;
+    std::mt19937 m_random;
+};
+
+// Applies the operations with the rules of the game: UP and DOWN are
+// ignored when a bike cannot change lane, a bike falls when it crosses or
+// lands on a hole (only the landing cell counts for JUMP), and the game is
+// over when the bikes reach the last column, when fewer bikes than needed
+// are left or after k_maxTurns turns.
+class Referee
+{
+public:
+
+    static const int k_maxTurns = IA::k_maxTurns;
+
+    Referee( const BridgeMap &map ) : m_map( map ), m_speed( 0 ), m_turn( 0 )
+    {
+        for ( int i = 0; i < m_map.m_nMotorbikes; ++i )
+        {
+            m_motorbikes[ i ].m_x = 0;
+            m_motorbikes[ i ].m_y = m_map.m_startLanes[ i ];
+            m_motorbikes[ i ].m_isActive = 1;
+        }
+    }
+
+    // Returns false when the game is over
+    bool Apply( Operation operation )
+    {
+        ++m_turn;
+        if ( operation == SPEED ) m_speed++;
+        if ( operation == SLOW && m_speed > 0 ) m_speed--;
+
+        int dy = operation == UP ? -1 : operation == DOWN ? 1 : 0;
+        for ( int i = 0; i < m_map.m_nMotorbikes; ++i )
+        {
+            int y = m_motorbikes[ i ].m_y + dy;
+            if ( m_motorbikes[ i ].m_isActive && ( y < 0 || y > 3 ) ) dy = 0;
+        }
+
+        for ( int i = 0; i < m_map.m_nMotorbikes; ++i )
+        {
+            IA::Motorbike &bike = m_motorbikes[ i ];
+            if ( !bike.m_isActive ) continue;
+
+            bool falls = false;
+            if ( operation == JUMP )
+            {
+                falls = IsHole( bike.m_y, bike.m_x + m_speed );
+            }
+            else
+            {
+                for ( int j = 1; j < m_speed; ++j )
+                {
+                    falls = falls || IsHole( bike.m_y, bike.m_x + j ) || IsHole( bike.m_y + dy, bike.m_x + j );
+                }
+                falls = falls || ( m_speed > 0 && IsHole( bike.m_y + dy, bike.m_x + m_speed ) );
+            }
+            bike.m_isActive = !falls;
+            bike.m_y += dy;
+        }
+        for ( int i = 0; i < m_map.m_nMotorbikes; ++i ) m_motorbikes[ i ].m_x += m_speed;
+
+        return !Won() && !Lost();
+    }
+
+    bool Won() const { return Active() >= m_map.m_nMotorbikesNeeded && m_motorbikes[ 0 ].m_x >= LaneSize() - 1; }
+    bool Lost() const { return Active() < m_map.m_nMotorbikesNeeded || ( !Won() && m_turn >= k_maxTurns ); }
+
+    int Active() const
+    {
+        int active = 0;
+        for ( int i = 0; i < m_map.m_nMotorbikes; ++i ) active += m_motorbikes[ i ].m_isActive;
+        return active;
+    }
+
+    int GetSpeed() const { return m_speed; }
+    int GetTurn() const { return m_turn; }
+    const IA::Motorbike *GetMotorbikes() const { return m_motorbikes; }
+
+private:
+
+    int LaneSize() const { return ( int ) m_map.m_lanes[ 0 ].size(); }
+    bool IsHole( int lane, int x ) const { return x < LaneSize() && m_map.m_lanes[ lane ][ x ] == '0'; }
+
+    const BridgeMap &m_map;
+    IA::Motorbike m_motorbikes[ 4 ];
+    int m_speed;
+    int m_turn;
+};
+
+struct GameResult
+{
+    bool m_won;
+    int m_turns;
+    int m_survivors;
+    double m_planningMs;
+    double m_maxTurnMs;
+    unsigned long long m_nodes;
+};
+
+GameResult Play( const BridgeMap &map, IA::Planner planner, double firstTurnBudget, double turnBudget )
+{
+    typedef std::chrono::steady_clock Clock;
+
+    GameResult result;
+    result.m_planningMs = 0.0;
+    result.m_maxTurnMs = 0.0;
+
+    const char *lanes[ 4 ];
+    for ( int lane = 0; lane < 4; ++lane ) lanes[ lane ] = map.m_lanes[ lane ].c_str();
+
+    IA ia( map.m_nMotorbikes, map.m_nMotorbikesNeeded );
+    ia.SetPlanner( planner );
+    ia.LoadMap( lanes, ( int ) map.m_lanes[ 0 ].size() );
+
+    Referee referee( map );
+    bool playing = true;
+    for ( int turn = 0; playing; ++turn )
+    {
+        ia.Update( referee.GetSpeed(), referee.GetMotorbikes() );
+
+        Clock::time_point start = Clock::now();
+        if ( turn == 0 ) ia.CalculateOperations( firstTurnBudget );
+        else ia.Replan( turnBudget );
+        double ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+        result.m_planningMs += ms;
+        result.m_maxTurnMs = std::max( result.m_maxTurnMs, ms );
+
+        playing = referee.Apply( ia.GetNextOperation() );
+    }
+
+    result.m_won = referee.Won();
+    result.m_turns = referee.GetTurn();
+    result.m_survivors = referee.Active();
+    result.m_nodes = ia.GetNodesExpanded();
+    return result;
+}
+
+double Mean( const std::vector<double> &values )
+{
+    double sum = 0.0;
+    for ( size_t i = 0; i < values.size(); ++i ) sum += values[ i ];
+    return values.empty() ? 0.0 : sum / values.size();
+}
+
+double Percentile( std::vector<double> values, double p )
+{
+    if ( values.empty() ) return 0.0;
+    std::sort( values.begin(), values.end() );
+    return values[ std::min( values.size() - 1, ( size_t ) ( p * values.size() ) ) ];
+}
+
+// Usage: "The Bridge Referee" [options] 2>/dev/null
+//   --seeds <n>          maps to play (100)
+//   --seed <s>           first seed (1)
+//   --length <cells>     bridge length (300)
+//   --density <p>        chance of a hole run per cell (0.05)
+//   --bikes <M>          bikes (4)
+//   --needed <V>         bikes that must survive (2)
+//   --planner <name>     backtracking, parallel or optimal (optimal)
+//   --budget <ms>        per turn budget, first turn included (0 = no limit)
+//   --verbose            one line per map
+// Every map has to be crossed within the 50 turns of the game, so longer
+// bridges need fewer holes: at 300 cells the optimal planner wins nearly
+// every map up to a density of 0.05, at 500 cells up to 0.04, and past
+// that most maps are lost on turns whatever the planner does.
+int main( int argc, char **argv )
+{
+    int nSeeds = 100;
+    unsigned int firstSeed = 1;
+    int length = 300;
+    float density = 0.05f;
+    int nMotorbikes = 4;
+    int nMotorbikesNeeded = 2;
+    IA::Planner planner = IA::OPTIMAL;
+    const char *plannerName = "optimal";
+    double budget = 0.0;
+    bool verbose = false;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const char *value = i + 1 < argc ? argv[ i + 1 ] : "";
+        if ( std::strcmp( argv[ i ], "--verbose" ) == 0 ) { verbose = true; continue; }
+        if ( std::strcmp( argv[ i ], "--seeds" ) == 0 ) nSeeds = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--seed" ) == 0 ) firstSeed = ( unsigned int ) std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--length" ) == 0 ) length = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--density" ) == 0 ) density = ( float ) std::atof( value );
+        else if ( std::strcmp( argv[ i ], "--bikes" ) == 0 ) nMotorbikes = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--needed" ) == 0 ) nMotorbikesNeeded = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--budget" ) == 0 ) budget = std::atof( value );
+        else if ( std::strcmp( argv[ i ], "--planner" ) == 0 )
+        {
+            plannerName = value;
+            if ( std::strcmp( value, "backtracking" ) == 0 ) planner = IA::BACKTRACKING;
+            else if ( std::strcmp( value, "parallel" ) == 0 ) planner = IA::PARALLEL;
+            else if ( std::strcmp( value, "optimal" ) == 0 ) planner = IA::OPTIMAL;
+            else
+            {
+                fprintf( stderr, "Unknown planner: %s\n", value );
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf( stderr, "Unknown option: %s\n", argv[ i ] );
+            return 1;
+        }
+        ++i;
+    }
+    nMotorbikes = std::min( std::max( nMotorbikes, 1 ), 4 );
+    nMotorbikesNeeded = std::min( std::max( nMotorbikesNeeded, 1 ), nMotorbikes );
+    length = std::max( length, 8 );
+
+    int won = 0;
+    int survivors = 0;
+    int turns = 0;
+    unsigned long long nodes = 0;
+    std::vector<double> planningMs;
+    std::vector<double> maxTurnMs;
+    for ( int s = 0; s < nSeeds; ++s )
+    {
+        unsigned int seed = firstSeed + s;
+        MapGenerator generator( seed );
+        BridgeMap map = generator.Generate( length, density, nMotorbikes, nMotorbikesNeeded );
+        GameResult result = Play( map, planner, budget, budget );
+
+        if ( result.m_won )
+        {
+            ++won;
+            survivors += result.m_survivors;
+            turns += result.m_turns;
+        }
+        nodes += result.m_nodes;
+        planningMs.push_back( result.m_planningMs );
+        maxTurnMs.push_back( result.m_maxTurnMs );
+
+        if ( verbose )
+        {
+            printf( "seed %u: %s in %d turns, %d bikes, %.3f ms planning (max turn %.3f ms), %llu nodes\n",
+                seed, result.m_won ? "won" : "lost", result.m_turns, result.m_survivors,
+                result.m_planningMs, result.m_maxTurnMs, result.m_nodes );
+        }
+    }
+
+    printf( "planner %s, %d maps of length %d, density %.3f, %d bikes, %d needed, budget %.1f ms\n",
+        plannerName, nSeeds, length, density, nMotorbikes, nMotorbikesNeeded, budget );
+    printf( "success: %d/%d (%.1f%%)\n", won, nSeeds, nSeeds ? 100.0 * won / nSeeds : 0.0 );
+    if ( won )
+    {
+        printf( "won games: %.2f bikes, %.2f turns on average\n", ( double ) survivors / won, ( double ) turns / won );
+    }
+    printf( "planning per game: mean %.3f ms, p50 %.3f ms, p95 %.3f ms, max %.3f ms\n",
+        Mean( planningMs ), Percentile( planningMs, 0.5 ), Percentile( planningMs, 0.95 ), Percentile( planningMs, 1.0 ) );
+    printf( "slowest turn per game: p50 %.3f ms, p95 %.3f ms, max %.3f ms\n",
+        Percentile( maxTurnMs, 0.5 ), Percentile( maxTurnMs, 0.95 ), Percentile( maxTurnMs, 1.0 ) );
+    printf( "nodes expanded: %.1f per game\n", nSeeds ? ( double ) nodes / nSeeds : 0.0 );
+
+    return 0;
+}
\ No newline at end of file
@@ -1,6 +1,18 @@
 #include <cstdio>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <queue>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include "InputReader.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "WorkerPool.h"
 
 // https://www.codingame.com/training/hard/the-bridge-episode-2
 
@@ -25,368 +37,982 @@ const char *k_operationStr[8] =
     "DOWN"
 };
 
+// Set of state keys shared by every search thread. It is split in shards
+// with a lock each, so threads seldom wait on one another and any of them
+// can add keys while the others look keys up
+class KeySet
+{
+public:
+
+    bool Contains( unsigned long long key ) const
+    {
+        const Shard &shard = m_shards[ ShardOf( key ) ];
+        std::lock_guard<std::mutex> lock( shard.m_mutex );
+        return shard.m_keys.count( key ) != 0;
+    }
+
+    void Insert( unsigned long long key )
+    {
+        Shard &shard = m_shards[ ShardOf( key ) ];
+        std::lock_guard<std::mutex> lock( shard.m_mutex );
+        shard.m_keys.insert( key );
+    }
+
+private:
+
+    static const int k_shardBits = 6;
+
+    // aligned so the locks of two shards don't share a cache line
+    struct alignas( 64 ) Shard
+    {
+        mutable std::mutex m_mutex;
+        std::unordered_set<unsigned long long> m_keys;
+    };
+
+    static int ShardOf( unsigned long long key ) { return ( int ) ( ( key * 0x9E3779B97F4A7C15ULL ) >> ( 64 - k_shardBits ) ); }
+
+    Shard m_shards[ 1 << k_shardBits ];
+};
+
 class IA
 {
 public:
 
+    enum Planner
+    {
+        BACKTRACKING,   // first plan found by a depth first search
+        PARALLEL,       // same plan as BACKTRACKING, subtrees split in threads
+        OPTIMAL         // most surviving bikes within the turns left, then fewest turns
+    };
+
+    // the game is lost when the bikes are not across after this many turns
+    static const int k_maxTurns = 50;
+
+    struct Motorbike
+    {
+        int m_x;
+        int m_y;
+        int m_isActive;
+    };
+
     IA( int nMotorbikes, int nMotorbikesNeeded )
-        : m_map( 0 )
-        , m_offset( 0 )
+        : m_planner( BACKTRACKING )
+        , m_laneSize( 0 )
         , m_nMotorbikes( nMotorbikes )
         , m_nMotorbikesNeeded( nMotorbikesNeeded )
+        , m_turn( 0 )
+        , m_planSize( 0 )
+        , m_hasLanes( false )
+        , m_planComplete( false )
+        , m_planFinal( false )
+        , m_planActive( 0 )
+        , m_bestTask( INT_MAX )
+        , m_budget( 0.0 )
+        , m_timedOut( false )
+        , m_searchSteps( 0 )
+        , m_nodesExpanded( 0 )
+        , m_reportedNodes( 0 )
+        , m_head( 0 )
+        , m_planNode( -1 )
+        , m_rootIdx( 0 )
     {
-        m_map = new char[ 4 * 500 ];
     }
-    ~IA()
+
+    // Reads the 4 lanes as views into the input buffer, so the length of
+    // the lanes is not bounded and they are not copied before LoadMap
+    bool ReadMap( InputReader &input )
     {
-        delete[] m_map;
+        const char *lanes[ 4 ];
+        int lengths[ 4 ];
+        if ( !input.ReadLines( 4, lanes, lengths ) ) return false;
+        LoadMap( lanes, *std::min_element( lengths, lengths + 4 ) );
+
+        TRACE_GAME( "Map (4 x %d)\n", m_laneSize );
+        return true;
     }
 
-    void ReadMap()
+    // Same as ReadMap, for lanes that are already in memory
+    void LoadMap( const char *const lanes[ 4 ], int laneSize )
     {
-        scanf( "%s%*c", m_map );
-        m_offset = 0;
-        while ( m_map[ m_offset++ ] != '\0' );
-        m_map[ m_offset - 1 ] = '\n';
-        m_laneSize = m_offset - 1;
-        m_size = m_offset * 4;
-        fread( &m_map[ m_offset ], sizeof( char ), m_offset * 3, stdin );
-
-        fprintf( stderr, "Map (4 x %d = %d):\n", m_offset, m_size );
-        fwrite( m_map, sizeof( char ), m_size, stderr );
+        m_laneSize = laneSize;
+        m_holeBits.assign( ( ( laneSize + 63 ) >> 6 ) * 4, 0 );
+        for ( int lane = 0; lane < 4; ++lane )
+        {
+            for ( int x = 0; x < laneSize; ++x )
+            {
+                if ( lanes[ lane ][ x ] == '0' ) m_holeBits[ ( x >> 6 ) * 4 + lane ] |= 1ULL << ( x & 63 );
+            }
+        }
     }
 
-    void Update()
+    // false when the input ends
+    bool Update( InputReader &input )
     {
-        static int turn = 1;
-        scanf( "%d", &m_speed );
-        fprintf( stderr, "# Turn %d\n", turn++ );
-        fprintf( stderr, "Current speed: %d\n", m_speed );
+        if ( !input.ReadInt( m_speed ) ) return false;
+        ++m_turn;
+        TRACE_TURN( "# Turn %d\n", m_turn );
+        TRACE_TURN( "Current speed: %d\n", m_speed );
         for ( int i = 0; i < m_nMotorbikes; ++i )
         {
-            scanf( "%d%d%d", &m_motorbikes[ i ].m_x, &m_motorbikes[ i ].m_y, &m_motorbikes[ i ].m_isActive );
-            fprintf( stderr, "> %d, %d, %d\n", m_motorbikes[ i ].m_x, m_motorbikes[ i ].m_y, m_motorbikes[ i ].m_isActive );
+            Motorbike &bike = m_motorbikes[ i ];
+            if ( !input.ReadInt( bike.m_x ) || !input.ReadInt( bike.m_y ) || !input.ReadInt( bike.m_isActive ) ) return false;
+            TRACE_TURN( "> %d, %d, %d\n", bike.m_x, bike.m_y, bike.m_isActive );
         }
-        fprintf( stderr, "***\n" );
+        TRACE_TURN( "***\n" );
+        return true;
+    }
+
+    // Same as Update, for a state that does not come from the input
+    void Update( int speed, const Motorbike *motorbikes )
+    {
+        ++m_turn;
+        m_speed = speed;
+        for ( int i = 0; i < m_nMotorbikes; ++i ) m_motorbikes[ i ] = motorbikes[ i ];
     }
 
-    void CalculateOperations();
+    // Search nodes expanded by every planning call so far
+    unsigned long long GetNodesExpanded() const { return m_nodesExpanded; }
+
+    void SetPlanner( Planner planner ) { m_planner = planner; }
+
+    // Plans from the last observed state, spending at most budgetMs
+    // milliseconds (0 = no limit); when the time runs out, or there is no
+    // plan at all, the best partial plan found is used
+    void CalculateOperations( double budgetMs = 0.0 ) { Plan( budgetMs, false ); }
+
+    // Keeps the current plan while the observed state is the expected one
+    // and the plan reaches the end; otherwise plans again from the observed
+    // state. The backtracking planners skip the dead states found in earlier
+    // turns. The optimal one also searches again when its last search ran
+    // out of time, keeping its plan unless one with more bikes is found
+    void Replan( double budgetMs );
 
     Operation GetNextOperation()
     {
-        Operation operation = m_operations.front();
-        m_operations.pop();
+        Operation operation = m_expected.m_speed == 0 ? SPEED : WAIT;
+        if ( !m_operations.empty() )
+        {
+            operation = m_operations.front();
+            m_operations.pop();
+        }
+
+        BikeState next;
+        if ( Move( m_expected, operation, next ) ) m_expected = next;
         return operation;
     }
 
 private:
 
-    bool Backtracking( std::vector<Operation> &operations, int idx, int pos, int speed, std::vector<int> lanes, std::vector<bool> active, int nActive );
+    // Whole search state; all the bikes share x, speed and lane moves, so
+    // the lanes are a single offset over the lanes of the first turn
+    struct BikeState
+    {
+        int m_pos;
+        short m_speed;
+        signed char m_lane;
+        unsigned char m_active;
+    };
 
-    struct Motorbike
+    // BFS tree node of the optimal planner
+    struct SearchNode
     {
-        int m_x;
-        int m_y;
-        int m_isActive;
+        BikeState m_state;
+        int m_parent;
+        int m_depth;
+        Operation m_operation;
     };
 
+    // State of one depth first search; the parallel planner runs one per
+    // subtree, numbered in the order the sequential search visits them
+    struct SearchContext
+    {
+        std::vector<Operation> m_plan;
+        int m_planSize;
+        // deepest plan prefix reached, used when the search gives up
+        std::vector<Operation> m_partial;
+        int m_partialSize;
+        int m_partialPos;
+        int m_task;
+        bool m_stopped;
+        unsigned int m_steps;
+        unsigned long long m_expanded;
+    };
+
+    void ResetContext( SearchContext &context, int task, int idx );
+    bool Stopped( SearchContext &context )
+    {
+        if ( context.m_stopped ) return true;
+        if ( ( ++context.m_steps & 255 ) == 0 )
+        {
+            context.m_stopped = context.m_task > m_bestTask.load( std::memory_order_relaxed )
+                || ( m_budget > 0.0 && std::chrono::steady_clock::now() >= m_deadline );
+        }
+        return context.m_stopped;
+    }
+    bool Backtracking( SearchContext &context, BikeState state, int idx );
+    bool ParallelBacktracking( BikeState state, int idx );
+    // onPlan: the bikes are where the current plan said
+    void Plan( double budgetMs, bool onPlan );
+    // resume goes on from the tree left by RerootBreadthFirst; only plans
+    // that save more than keptActive bikes are looked for
+    bool BreadthFirst( BikeState state, int idx, bool resume, int keptActive );
+    // Keeps the nodes below the one the plan reaches after executed
+    // operations, which becomes the root; false when there is no such node
+    bool RerootBreadthFirst( int executed, BikeState state );
+    void AddReached( const BikeState &state )
+    {
+        if ( state.m_pos < m_laneSize - 1 ) m_reached[ StateKey( state ) >> 4 ] |= ( unsigned short ) ( 1 << state.m_active );
+    }
+    bool Reached( const BikeState &state ) const
+    {
+        std::unordered_map<unsigned long long, unsigned short>::const_iterator it = m_reached.find( StateKey( state ) >> 4 );
+        return it != m_reached.end() && ( it->second & m_dominating[ state.m_lane + 3 ][ state.m_active ] );
+    }
+    BikeState ObservedState();
+    bool TimeUp()
+    {
+        if ( m_budget <= 0.0 || m_timedOut ) return m_timedOut;
+        if ( ( ++m_searchSteps & 255 ) == 0 )
+        {
+            m_timedOut = std::chrono::steady_clock::now() >= m_deadline;
+        }
+        return m_timedOut;
+    }
+    bool Move( BikeState state, Operation operation, BikeState &next ) const;
+    int HoleLanes( int from, int to ) const;
+    unsigned long long StateKey( BikeState state ) const;
+    static int CountActive( int active ) { return ( int ) std::bitset<4>( active ).count(); }
+    int Occupied( int active, int lane ) const
+    {
+        int occupied = 0;
+        for ( int m = 0; m < m_nMotorbikes; ++m )
+        {
+            int y = m_lanes[ m ] + lane;
+            if ( ( active & ( 1 << m ) ) && y >= 0 && y < 4 ) occupied |= 1 << y;
+        }
+        return occupied;
+    }
+
     struct Node
     {
         int m_jump;
         int m_motorbikes;
     };
 
-    char *m_map;
+    Planner m_planner;
+    // bit x % 64 of m_holeBits[ ( x / 64 ) * 4 + lane ] is set when the
+    // cell x of the lane is a hole; the 4 lanes of a word are contiguous
+    std::vector<unsigned long long> m_holeBits;
     int m_laneSize;
-    int m_size;
-    int m_offset;
     int m_speed;
     int m_nMotorbikes;
     int m_nMotorbikesNeeded;
     Motorbike m_motorbikes[ 4 ];
+    int m_lanes[ 4 ];
+    // turns observed so far, the current one included
+    int m_turn;
     std::queue<Operation> m_operations;
+    // operation stack of the search, indexed by depth
+    std::vector<Operation> m_plan;
+    int m_planSize;
+    bool m_hasLanes;
+    bool m_planComplete;
+    // no later search from the expected states can improve the plan
+    bool m_planFinal;
+    // bikes the complete plan saves
+    int m_planActive;
+    // state the bikes should be in when the next operation is sent
+    BikeState m_expected;
+    SearchContext m_search;
+    std::vector<SearchContext> m_tasks;
+    // first subtree (in sequential order) where the parallel search succeeded
+    std::atomic<int> m_bestTask;
+    double m_budget;
+    std::chrono::steady_clock::time_point m_deadline;
+    bool m_timedOut;
+    unsigned int m_searchSteps;
+    unsigned long long m_nodesExpanded;
+    // part of m_nodesExpanded already added to the metrics counter
+    unsigned long long m_reportedNodes;
+    // states from which no plan keeps m_nMotorbikesNeeded bikes alive,
+    // shared by every thread of the parallel planner
+    KeySet m_deadStates;
+    WorkerPool m_pool;
+    std::vector<SearchNode> m_nodes;
+    // next node of m_nodes the BFS expands
+    int m_head;
+    // node the current plan ends at, and plan operations before the root
+    int m_planNode;
+    int m_rootIdx;
+    // children of m_nodes pruned by m_reached, in the order they were found
+    std::vector<SearchNode> m_pruned;
+    // active masks already reached at each (pos, speed, lane) by the BFS
+    std::unordered_map<unsigned long long, unsigned short> m_reached;
+    // m_dominating[ lane + 3 ][ active ]: active masks that dominate active
+    unsigned short m_dominating[ 7 ][ 16 ];
+    // scratch of RerootBreadthFirst
+    std::vector<int> m_remap;
+    std::vector<SearchNode> m_rebuilt;
+    std::vector<SearchNode> m_rebuiltPruned;
+    std::vector<SearchNode> m_revived;
 };
 
-bool IA::Backtracking( std::vector<Operation> &operations, int idx, int pos, int speed, std::vector<int> lanes, std::vector<bool> active, int nActive )
+// Packs pos (24 bits), speed (16 bits), lane offset (3 bits) and active mask
+unsigned long long IA::StateKey( BikeState state ) const
 {
-    bool end = false;
-    std::vector<bool> activeBU(active.begin(), active.end());
+    unsigned long long key = ( unsigned long long ) state.m_pos;
+    key = ( key << 16 ) | ( unsigned short ) state.m_speed;
+    key = ( key << 3 ) | ( state.m_lane + 3 );
+    key = ( key << 4 ) | state.m_active;
+    return key;
+}
 
-    if ( pos >= m_laneSize - 1 ) return true;
+// Bit L of the result is set when lane L has a hole in the cells [from, to]
+int IA::HoleLanes( int from, int to ) const
+{
+    if ( to >= m_laneSize ) to = m_laneSize - 1;
+    if ( from > to ) return 0;
 
-    for ( int i = 0; !end && i < OSIZE; ++i )
+    int first = from >> 6;
+    int last = to >> 6;
+    unsigned long long firstMask = ~0ULL << ( from & 63 );
+    unsigned long long lastMask = ~0ULL >> ( 63 - ( to & 63 ) );
+    const unsigned long long *bits = &m_holeBits[ first * 4 ];
+    unsigned long long any[ 4 ];
+    for ( int lane = 0; lane < 4; ++lane )
+    {
+        any[ lane ] = bits[ lane ] & firstMask;
+    }
+    if ( first == last )
     {
-        bool ok = true;
-        int na = nActive;
-        int s = speed;
-        switch ( i )
+        for ( int lane = 0; lane < 4; ++lane ) any[ lane ] &= lastMask;
+    }
+    else
+    {
+        for ( int w = first + 1; w < last; ++w )
         {
-        case SPEED:
-            s++;
-        case WAIT:
-            for ( int m = 0; m < m_nMotorbikes; ++m )
-            {
-                if ( active[ m ] )
-                {
-                    int p = lanes[ m ] * m_offset + pos;
-                    for ( int j = 1; j <= s; ++j )
-                    {
-                        if ( pos + j >= m_laneSize - 1 )
-                        {
-                            break;
-                        }
-                        if ( m_map[ p + j ] == '0' )
-                        {
-                            ok = false;
-                            break;
-                        }
-                    }
-                    if ( !ok )
-                    {
-                        active[ m ] = false;
-                        na--;
-                        if ( na < m_nMotorbikesNeeded ) break;
-                    }
-                }
-            }
-            if ( na >= m_nMotorbikesNeeded )
-            {
-                operations.push_back( s > speed ? SPEED : WAIT );
-                end = Backtracking( operations, idx + 1, pos + s, s, lanes, active, na );
-                if ( !end ) operations.pop_back();
-            }
-            break;
+            bits = &m_holeBits[ w * 4 ];
+            for ( int lane = 0; lane < 4; ++lane ) any[ lane ] |= bits[ lane ];
+        }
+        bits = &m_holeBits[ last * 4 ];
+        for ( int lane = 0; lane < 4; ++lane ) any[ lane ] |= bits[ lane ] & lastMask;
+    }
 
-        case JUMP:
-            for ( int m = 0; m < m_nMotorbikes; ++m )
-            {
-                if ( active[ m ] )
-                {
-                    int p = lanes[ m ] * m_offset + pos + s;
-                    if ( pos + s >= m_laneSize )
-                    {
-                        break;
-                    }
-                    if ( m_map[ p ] == '0' )
-                    {
-                        active[ m ] = false;
-                        na--;
-                        if ( na < m_nMotorbikesNeeded ) break;
-                    }
-                }
-            }
-            if ( na >= m_nMotorbikesNeeded )
-            {
-                operations.push_back( JUMP );
-                end = Backtracking( operations, idx + 1, pos + s, s, lanes, active, na );
-                if ( !end ) operations.pop_back();
-            }
-            break;
+    return ( any[ 0 ] != 0 ) | ( any[ 1 ] != 0 ) << 1 | ( any[ 2 ] != 0 ) << 2 | ( any[ 3 ] != 0 ) << 3;
+}
 
-        case SLOW:
-            if ( speed <= 1 )
-            {
-                break;
-            }
-            s--;
-            for ( int m = 0; m < m_nMotorbikes; ++m )
-            {
-                if ( active[ m ] )
-                {
-                    int p = lanes[ m ] * m_offset + pos;
-                    for ( int j = 1; j <= s; ++j )
-                    {
-                        if ( pos + j >= m_laneSize )
-                        {
-                            break;
-                        }
-                        if ( m_map[ p + j ] == '0' )
-                        {
-                            ok = false;
-                            break;
-                        }
-                    }
-                    if ( !ok )
-                    {
-                        active[ m ] = false;
-                        na--;
-                        if ( na < m_nMotorbikesNeeded ) break;
-                    }
-                }
-            }
-            if ( na >= m_nMotorbikesNeeded )
-            {
-                operations.push_back( SLOW );
-                end = Backtracking( operations, idx + 1, pos + s, s, lanes, active, na );
-                if ( !end ) operations.pop_back();
-            }
-            break;
+// Applies an operation to every active bike; returns false when the
+// operation is not allowed in this state
+bool IA::Move( BikeState state, Operation operation, BikeState &next ) const
+{
+    int speed = state.m_speed;
+    int dy = 0;
+    int occupied = Occupied( state.m_active, state.m_lane );
 
-        case UP:
-            ok = true;
-            for ( int m = 0; m < m_nMotorbikes; ++m )
-            {
-                if ( active[ m ] )
-                {
-                    ok = lanes[ m ] > 0;
-                    break;
-                }
-            }
-            if ( !ok )
-            {
-                break;
-            }
-            for ( int m = 0; m < m_nMotorbikes; ++m )
+    switch ( operation )
+    {
+    case SPEED:
+        speed++;
+        break;
+    case SLOW:
+        if ( speed <= 1 ) return false;
+        speed--;
+        break;
+    case UP:
+        if ( occupied & 1 ) return false;
+        dy = -1;
+        break;
+    case DOWN:
+        if ( occupied & 8 ) return false;
+        dy = 1;
+        break;
+    default:
+        break;
+    }
+
+    // lanes (before the move) where a bike falls
+    int pos = state.m_pos;
+    int fatal = 0;
+    if ( operation == JUMP )
+    {
+        fatal = HoleLanes( pos + speed, pos + speed );
+    }
+    else if ( dy < 0 )
+    {
+        fatal = HoleLanes( pos + 1, pos + speed - 1 ) | HoleLanes( pos + 1, pos + speed ) << 1;
+    }
+    else if ( dy > 0 )
+    {
+        fatal = HoleLanes( pos + 1, pos + speed - 1 ) | HoleLanes( pos + 1, pos + speed ) >> 1;
+    }
+    else
+    {
+        fatal = HoleLanes( pos + 1, pos + speed );
+    }
+
+    next.m_pos = pos + speed;
+    next.m_speed = ( short ) speed;
+    next.m_lane = ( signed char ) ( state.m_lane + dy );
+    next.m_active = state.m_active;
+    if ( fatal & occupied )
+    {
+        for ( int m = 0; m < m_nMotorbikes; ++m )
+        {
+            if ( !( state.m_active & ( 1 << m ) ) ) continue;
+            if ( fatal & ( 1 << ( m_lanes[ m ] + state.m_lane ) ) ) next.m_active &= ~( 1 << m );
+        }
+    }
+
+    return true;
+}
+
+void IA::ResetContext( SearchContext &context, int task, int idx )
+{
+    if ( ( int ) context.m_plan.size() < m_laneSize + 2 )
+    {
+        context.m_plan.assign( m_laneSize + 2, WAIT );
+        context.m_partial.assign( m_laneSize + 2, WAIT );
+    }
+    std::copy( m_plan.begin(), m_plan.begin() + idx, context.m_plan.begin() );
+    context.m_planSize = idx;
+    context.m_partialSize = idx;
+    context.m_partialPos = -1;
+    context.m_task = task;
+    context.m_stopped = false;
+    context.m_steps = 0;
+    context.m_expanded = 0;
+}
+
+bool IA::Backtracking( SearchContext &context, BikeState state, int idx )
+{
+    if ( state.m_pos >= m_laneSize - 1 )
+    {
+        context.m_planSize = idx;
+        return true;
+    }
+
+    if ( state.m_pos > context.m_partialPos )
+    {
+        context.m_partialPos = state.m_pos;
+        context.m_partialSize = idx;
+        std::copy( context.m_plan.begin(), context.m_plan.begin() + idx, context.m_partial.begin() );
+    }
+
+    unsigned long long key = StateKey( state );
+    if ( m_deadStates.Contains( key ) ) return false;
+    ++context.m_expanded;
+
+    for ( int i = 0; i < OSIZE; ++i )
+    {
+        if ( Stopped( context ) ) return false;
+
+        BikeState next;
+        if ( !Move( state, ( Operation ) i, next ) ) continue;
+        if ( CountActive( next.m_active ) < m_nMotorbikesNeeded ) continue;
+
+        context.m_plan[ idx ] = ( Operation ) i;
+        if ( Backtracking( context, next, idx + 1 ) ) return true;
+    }
+
+    // an interrupted subtree is not known to be dead
+    if ( !context.m_stopped ) m_deadStates.Insert( key );
+
+    return false;
+}
+
+// Splits the search in the subtrees of the first two operations and runs
+// them in the worker threads. When a subtree succeeds, only the subtrees
+// after it in sequential order are cancelled, so the plan is the one the
+// sequential search would find. A dead state found by one thread is pruned
+// by all of them right away; skipping a dead state never changes which plan
+// is found first. No subtree is started once the time is up.
+bool IA::ParallelBacktracking( BikeState state, int idx )
+{
+    if ( state.m_pos >= m_laneSize - 1 ) return true;
+
+    struct Task
+    {
+        BikeState m_state;
+        Operation m_operations[ 2 ];
+        int m_depth;
+    };
+    std::vector<Task> tasks;
+    // first level states and subtrees in the order the sequential search
+    // visits them (-1 - i for the state after operation i, k for task k)
+    std::vector<int> order;
+    BikeState firsts[ OSIZE ];
+    for ( int i = 0; i < OSIZE; ++i )
+    {
+        Task task;
+        task.m_operations[ 0 ] = ( Operation ) i;
+        task.m_depth = 1;
+        BikeState &first = firsts[ i ];
+        if ( !Move( state, ( Operation ) i, first ) ) continue;
+        if ( CountActive( first.m_active ) < m_nMotorbikesNeeded ) continue;
+        order.push_back( -1 - i );
+        if ( first.m_pos >= m_laneSize - 1 || m_deadStates.Contains( StateKey( first ) ) )
+        {
+            task.m_state = first;
+            order.push_back( ( int ) tasks.size() );
+            tasks.push_back( task );
+            continue;
+        }
+
+        task.m_depth = 2;
+        for ( int j = 0; j < OSIZE; ++j )
+        {
+            if ( !Move( first, ( Operation ) j, task.m_state ) ) continue;
+            if ( CountActive( task.m_state.m_active ) < m_nMotorbikesNeeded ) continue;
+            task.m_operations[ 1 ] = ( Operation ) j;
+            order.push_back( ( int ) tasks.size() );
+            tasks.push_back( task );
+        }
+    }
+
+    int nTasks = ( int ) tasks.size();
+    if ( ( int ) m_tasks.size() < nTasks ) m_tasks.resize( nTasks );
+    for ( int k = 0; k < nTasks; ++k )
+    {
+        ResetContext( m_tasks[ k ], k, idx );
+        for ( int d = 0; d < tasks[ k ].m_depth; ++d )
+        {
+            m_tasks[ k ].m_plan[ idx + d ] = tasks[ k ].m_operations[ d ];
+        }
+    }
+
+    m_bestTask.store( INT_MAX );
+    std::atomic<int> nextTask( 0 );
+    auto worker = [ & ]( int )
+    {
+        while ( m_budget <= 0.0 || std::chrono::steady_clock::now() < m_deadline )
+        {
+            int k = nextTask++;
+            if ( k >= nTasks || k >= m_bestTask.load() ) return;
+            SearchContext &context = m_tasks[ k ];
+            if ( !Backtracking( context, tasks[ k ].m_state, idx + tasks[ k ].m_depth ) ) continue;
+
+            int best = m_bestTask.load();
+            while ( k < best && !m_bestTask.compare_exchange_weak( best, k ) );
+        }
+    };
+    m_pool.Run( std::min( WorkerPool::GetMaxThreads(), nTasks ), worker );
+
+    for ( int k = 0; k < nTasks; ++k ) m_nodesExpanded += m_tasks[ k ].m_expanded;
+
+    int best = m_bestTask.load();
+    bool found = best < nTasks;
+    if ( found )
+    {
+        SearchContext &context = m_tasks[ best ];
+        std::copy( context.m_plan.begin(), context.m_plan.begin() + context.m_planSize, m_plan.begin() );
+        m_planSize = context.m_planSize;
+    }
+    else
+    {
+        // same deepest prefix as the sequential search: the first one, in
+        // visiting order, that reaches the furthest position
+        int partialPos = state.m_pos;
+        int partial = INT_MAX;
+        for ( size_t o = 0; o < order.size(); ++o )
+        {
+            int pos = order[ o ] < 0 ? firsts[ -1 - order[ o ] ].m_pos : m_tasks[ order[ o ] ].m_partialPos;
+            if ( pos > partialPos )
             {
-                if ( active[ m ] )
-                {
-                    int p = lanes[ m ] * m_offset + pos;
-                    for ( int j = 1; j < s; ++j )
-                    {
-                        if ( pos + j >= m_laneSize )
-                        {
-                            break;
-                        }
-                        if ( m_map[ p - m_offset + j ] == '0' || m_map[ p + j ] == '0' )
-                        {
-                            ok = false;
-                            break;
-                        }
-                    }
-                    p += s - m_offset;
-                    if ( !ok || m_map[ p ] == '0' )
-                    {
-                        active[ m ] = false;
-                        na--;
-                        if ( na < m_nMotorbikesNeeded ) break;
-                    }
-                }
+                partialPos = pos;
+                partial = order[ o ];
             }
-            if ( na >= m_nMotorbikesNeeded )
+        }
+        if ( partial < 0 )
+        {
+            m_plan[ idx ] = ( Operation ) ( -1 - partial );
+            m_planSize = idx + 1;
+        }
+        else if ( partial < nTasks )
+        {
+            SearchContext &context = m_tasks[ partial ];
+            std::copy( context.m_partial.begin(), context.m_partial.begin() + context.m_partialSize, m_plan.begin() );
+            m_planSize = context.m_partialSize;
+        }
+    }
+    m_bestTask.store( INT_MAX );
+
+    return found;
+}
+
+// Explores the states turn by turn, so the first plan that reaches the end
+// with a given number of bikes is also the shortest one with that number.
+// Only plans that end within the turns left count; states deeper than that
+// are not expanded.
+// A state is pruned when the same (pos, speed, lane) was already reached,
+// in the same or an earlier turn, with a superset of its bikes that has no
+// extra bike on the border lanes (so it can still do every UP and DOWN).
+bool IA::BreadthFirst( BikeState state, int idx, bool resume, int keptActive )
+{
+    for ( int lane = -3; lane <= 3; ++lane )
+    {
+        for ( int active = 0; active < 16; ++active )
+        {
+            m_dominating[ lane + 3 ][ active ] = 0;
+            if ( active >= ( 1 << m_nMotorbikes ) ) continue;
+            int border = Occupied( active, lane ) & 9;
+            for ( int mask = 0; mask < ( 1 << m_nMotorbikes ); ++mask )
             {
-                for ( int m = 0; m < m_nMotorbikes; ++m )
-                {
-                    lanes[ m ]--;
-                }
-                operations.push_back( UP );
-                end = Backtracking( operations, idx + 1, pos + s, s, lanes, active, na );
-                if ( !end )
+                if ( ( mask & active ) == active && ( Occupied( mask, lane ) & 9 ) == border )
                 {
-                    operations.pop_back();
-                    for ( int m = 0; m < m_nMotorbikes; ++m ) lanes[ m ]++;
+                    m_dominating[ lane + 3 ][ active ] |= ( unsigned short ) ( 1 << mask );
                 }
             }
-            break;
+        }
+    }
+
+    // idx operations are already planned before state
+    int maxDepth = k_maxTurns - ( m_turn - 1 ) - idx;
+
+    SearchNode node;
+    if ( !resume )
+    {
+        m_nodes.clear();
+        m_pruned.clear();
+        m_reached.clear();
+        node.m_state = state;
+        node.m_parent = -1;
+        node.m_depth = 0;
+        node.m_operation = WAIT;
+        m_nodes.push_back( node );
+        m_reached[ StateKey( state ) >> 4 ] = ( unsigned short ) ( 1 << state.m_active );
+        m_head = 0;
+    }
+    int pushed = resume ? 0 : 1;
+
+    int best = -1;
+    int bestActive = keptActive;
+    int maxActive = CountActive( state.m_active );
+    int partial = 0;
+    // partial plans prefer more bikes, then a longer way
+    auto rank = [ & ]( int n )
+    {
+        const BikeState &nodeState = m_nodes[ n ].m_state;
+        const BikeState &partialState = m_nodes[ partial ].m_state;
+        int nActive = CountActive( nodeState.m_active );
+        int partialActive = CountActive( partialState.m_active );
+        if ( nActive > partialActive || ( nActive == partialActive && nodeState.m_pos > partialState.m_pos ) )
+        {
+            partial = n;
+        }
+        if ( nodeState.m_pos >= m_laneSize - 1 && nActive > bestActive )
+        {
+            best = n;
+            bestActive = nActive;
+        }
+    };
+    // the nodes kept from the last turn
+    for ( int n = 0; n < ( int ) m_nodes.size(); ++n ) rank( n );
 
-        case DOWN:
-            for ( int m = 0; m < m_nMotorbikes; ++m )
+    for ( ; m_head < ( int ) m_nodes.size() && bestActive < maxActive && !TimeUp(); ++m_head )
+    {
+        // the nodes are in depth order, the rest are as deep
+        if ( m_nodes[ m_head ].m_depth >= maxDepth ) break;
+        BikeState current = m_nodes[ m_head ].m_state;
+        int depth = m_nodes[ m_head ].m_depth + 1;
+        ++m_nodesExpanded;
+        for ( int i = 0; i < OSIZE; ++i )
+        {
+            BikeState next;
+            if ( !Move( current, ( Operation ) i, next ) ) continue;
+
+            // a later plan has to save more bikes to be better
+            int nActive = CountActive( next.m_active );
+            if ( nActive <= bestActive ) continue;
+
+            node.m_state = next;
+            node.m_parent = m_head;
+            node.m_depth = depth;
+            node.m_operation = ( Operation ) i;
+            if ( next.m_pos < m_laneSize - 1 )
             {
-                if ( active[ m_nMotorbikes - 1 - m ] )
+                unsigned short &reached = m_reached[ StateKey( next ) >> 4 ];
+                if ( reached & m_dominating[ next.m_lane + 3 ][ next.m_active ] )
                 {
-                    ok = lanes[ m ] < 3;
-                    break;
+                    // a reroot has to check it is still covered
+                    m_pruned.push_back( node );
+                    continue;
                 }
+                reached |= ( unsigned short ) ( 1 << next.m_active );
             }
-            if ( !ok )
-            {
-                break;
-            }
-            for ( int m = 0; m < m_nMotorbikes; ++m )
+
+            m_nodes.push_back( node );
+            ++pushed;
+            rank( ( int ) m_nodes.size() - 1 );
+            if ( bestActive == maxActive ) break;
+        }
+    }
+
+    bool found = best >= 0;
+    if ( found ) m_planActive = bestActive;
+    m_planNode = found ? best : partial;
+    m_rootIdx = idx;
+
+    m_planSize = idx + m_nodes[ m_planNode ].m_depth;
+    for ( int n = m_planNode, i = m_planSize - 1; m_nodes[ n ].m_parent >= 0; n = m_nodes[ n ].m_parent, --i )
+    {
+        m_plan[ i ] = m_nodes[ n ].m_operation;
+    }
+    METRICS_ADD( "bridge.queue_pushes", pushed );
+
+    return found;
+}
+
+// The nodes are kept in BFS order with their parents first, so one pass
+// finds the subtree. The other branches are cut, and so are the reached
+// masks they set, which may have pruned children below the new root. The
+// tree is rebuilt level by level from the kept nodes: a pruned child that no
+// kept node as deep or shallower covers any more is added back, and when its
+// level was already expanded, it is expanded too
+bool IA::RerootBreadthFirst( int executed, BikeState state )
+{
+    int depth = executed - m_rootIdx;
+    if ( m_planNode < 0 || depth < 0 || depth > m_nodes[ m_planNode ].m_depth ) return false;
+    int root = m_planNode;
+    while ( m_nodes[ root ].m_depth > depth ) root = m_nodes[ root ].m_parent;
+    const BikeState &rootState = m_nodes[ root ].m_state;
+    if ( rootState.m_pos != state.m_pos || rootState.m_speed != state.m_speed
+        || rootState.m_lane != state.m_lane || rootState.m_active != state.m_active ) return false;
+
+    m_remap.assign( m_nodes.size(), -1 );
+    int kept = 0;
+    int head = 0;
+    for ( int n = root; n < ( int ) m_nodes.size(); ++n )
+    {
+        SearchNode node = m_nodes[ n ];
+        if ( n != root && m_remap[ node.m_parent ] < 0 ) continue;
+        node.m_parent = n == root ? -1 : m_remap[ node.m_parent ];
+        node.m_depth -= depth;
+        if ( n < m_head ) head = kept + 1;
+        m_remap[ n ] = kept;
+        m_nodes[ kept++ ] = node;
+    }
+    m_nodes.resize( kept );
+
+    int nPruned = 0;
+    for ( size_t i = 0; i < m_pruned.size(); ++i )
+    {
+        SearchNode node = m_pruned[ i ];
+        if ( m_remap[ node.m_parent ] < 0 ) continue;
+        node.m_parent = m_remap[ node.m_parent ];
+        node.m_depth -= depth;
+        m_pruned[ nPruned++ ] = node;
+    }
+    m_pruned.resize( nPruned );
+
+    // levels above headDepth are expanded, and at headDepth the kept nodes
+    // before head
+    int headDepth = head < kept ? m_nodes[ head ].m_depth : m_nodes[ kept - 1 ].m_depth;
+    int maxDepth = k_maxTurns - ( m_turn - 1 );
+    int newHead = 0;
+    m_reached.clear();
+    m_rebuilt.clear();
+    m_rebuiltPruned.clear();
+    m_revived.clear();
+    // both lists are in depth order, and so are the revived children
+    int n = 0;
+    int p = 0;
+    size_t r = 0;
+    for ( int level = 0; n < kept || p < nPruned || r < m_revived.size(); ++level )
+    {
+        for ( ; n < kept && m_nodes[ n ].m_depth == level; ++n )
+        {
+            SearchNode node = m_nodes[ n ];
+            if ( node.m_parent >= 0 ) node.m_parent = m_remap[ node.m_parent ];
+            if ( n == head ) newHead = ( int ) m_rebuilt.size();
+            m_remap[ n ] = ( int ) m_rebuilt.size();
+            m_rebuilt.push_back( node );
+            AddReached( node.m_state );
+        }
+        if ( head == kept && level == headDepth ) newHead = ( int ) m_rebuilt.size();
+
+        for ( ; p < nPruned && m_pruned[ p ].m_depth == level; ++p )
+        {
+            m_pruned[ p ].m_parent = m_remap[ m_pruned[ p ].m_parent ];
+            m_revived.push_back( m_pruned[ p ] );
+        }
+        for ( ; r < m_revived.size() && m_revived[ r ].m_depth == level; ++r )
+        {
+            SearchNode node = m_revived[ r ];
+            if ( Reached( node.m_state ) )
             {
-                if ( active[ m ] )
-                {
-                    int p = lanes[ m ] * m_offset + pos;
-                    for ( int j = 1; j < s; ++j )
-                    {
-                        if ( pos + j >= m_laneSize )
-                        {
-                            break;
-                        }
-                        if ( m_map[ p + j ] == '0' || m_map[ p + m_offset + j ] == '0' )
-                        {
-                            ok = false;
-                            break;
-                        }
-                    }
-                    p += s + m_offset;
-                    if ( !ok || m_map[ p ] == '0' )
-                    {
-                        active[ m ] = false;
-                        na--;
-                        if ( na < m_nMotorbikesNeeded ) break;
-                    }
-                }
+                m_rebuiltPruned.push_back( node );
+                continue;
             }
-            if ( na >= m_nMotorbikesNeeded )
+            int parent = ( int ) m_rebuilt.size();
+            m_rebuilt.push_back( node );
+            AddReached( node.m_state );
+            if ( level >= headDepth || level >= maxDepth ) continue;
+
+            ++m_nodesExpanded;
+            for ( int i = 0; i < OSIZE; ++i )
             {
-                for ( int m = 0; m < m_nMotorbikes; ++m )
-                {
-                    if ( active[ m ] ) lanes[ m ]++;
-                }
-                operations.push_back( DOWN );
-                end = Backtracking( operations, idx + 1, pos + s, s, lanes, active, na );
-                if ( !end )
-                {
-                    operations.pop_back();
-                    for ( int m = 0; m < m_nMotorbikes; ++m ) lanes[ m ]--;
-                }
+                BikeState next;
+                if ( !Move( node.m_state, ( Operation ) i, next ) || CountActive( next.m_active ) < m_nMotorbikesNeeded ) continue;
+                SearchNode child;
+                child.m_state = next;
+                child.m_parent = parent;
+                child.m_depth = level + 1;
+                child.m_operation = ( Operation ) i;
+                m_revived.push_back( child );
             }
-            break;
         }
+    }
 
-        for ( int m = 0; m < m_nMotorbikes; ++m )
+    METRICS_ADD( "bridge.revived_nodes", m_rebuilt.size() - kept );
+    m_nodes.swap( m_rebuilt );
+    m_pruned.swap( m_rebuiltPruned );
+    m_head = newHead;
+    return true;
+}
+
+IA::BikeState IA::ObservedState()
+{
+    // the lanes of the first turn are the base of every lane offset, so
+    // dead states stay valid from one turn to the next
+    if ( !m_hasLanes )
+    {
+        for ( int i = 0; i < m_nMotorbikes; ++i ) m_lanes[ i ] = m_motorbikes[ i ].m_y;
+        m_hasLanes = true;
+    }
+
+    BikeState state;
+    state.m_pos = m_motorbikes[ 0 ].m_x;
+    state.m_speed = ( short ) m_speed;
+    state.m_lane = 0;
+    state.m_active = 0;
+    for ( int i = m_nMotorbikes - 1; i >= 0; --i )
+    {
+        if ( m_motorbikes[ i ].m_isActive )
         {
-            active[ m ] = activeBU[ m ];
+            state.m_active |= 1 << i;
+            state.m_pos = m_motorbikes[ i ].m_x;
+            state.m_lane = ( signed char ) ( m_motorbikes[ i ].m_y - m_lanes[ i ] );
         }
     }
+    return state;
+}
+
+void IA::Replan( double budgetMs )
+{
+    METRICS_TIME( "bridge.replan" );
+    BikeState observed = ObservedState();
+    bool onPlan = !m_operations.empty()
+        && observed.m_pos == m_expected.m_pos
+        && observed.m_speed == m_expected.m_speed
+        && observed.m_lane == m_expected.m_lane
+        && observed.m_active == m_expected.m_active;
+    if ( onPlan && m_planFinal ) return;
 
-    return end;
+    TRACE_TURN( "%s\n", onPlan ? "Improving plan" : "Planning from observed state" );
+    Plan( budgetMs, onPlan );
 }
 
-void IA::CalculateOperations()
+void IA::Plan( double budgetMs, bool onPlan )
 {
-    std::vector<Operation> operations;
-    std::vector<bool> active;
-    int startX = 0;
+    METRICS_TIME( "bridge.calculate_operations" );
+    BikeState state = ObservedState();
+    m_expected = state;
+    // operations of the last plan already sent
+    int executed = m_planSize - ( int ) m_operations.size();
+    // the rest of a complete plan stays valid while the bikes follow it
+    std::queue<Operation> kept;
+    if ( onPlan && m_planComplete ) kept.swap( m_operations );
+    while ( !m_operations.empty() ) m_operations.pop();
+
+    // every operation moves the bikes at least one cell forward
+    if ( ( int ) m_plan.size() < m_laneSize + 2 ) m_plan.assign( m_laneSize + 2, WAIT );
+    m_planSize = 0;
     if ( m_speed == 0 )
     {
-        operations.push_back( SPEED );
-        m_speed = 1;
-        startX = 1;
+        m_plan[ m_planSize++ ] = SPEED;
+        state.m_speed = 1;
+        state.m_pos += 1;
+    }
+
+    m_budget = budgetMs;
+    m_deadline = std::chrono::steady_clock::now() + std::chrono::microseconds( ( long long ) ( budgetMs * 1000.0 ) );
+    m_timedOut = false;
+
+    if ( m_planner == OPTIMAL )
+    {
+        bool resume = onPlan && m_planSize == 0 && RerootBreadthFirst( executed, state );
+        TRACE_TURN( "BFS %s (%d nodes kept)\n", resume ? "resumed" : "restarted", resume ? ( int ) m_nodes.size() : 0 );
+        // a plan kept from the last turn is already the shortest with its
+        // bikes, so a new tree only has to look for plans with more bikes
+        int keptActive = kept.empty() || resume ? m_nMotorbikesNeeded - 1 : m_planActive;
+        m_planComplete = BreadthFirst( state, m_planSize, resume, keptActive );
+        if ( !m_planComplete && !kept.empty() )
+        {
+            TRACE_TURN( "Keeping the plan with %d bikes\n", keptActive );
+            for ( m_planSize = 0; !kept.empty(); kept.pop() ) m_plan[ m_planSize++ ] = kept.front();
+            m_planComplete = true;
+            // the tree does not hold this plan
+            m_planNode = -1;
+        }
+        m_planFinal = m_planComplete && !m_timedOut;
+    }
+    else if ( m_planner == PARALLEL )
+    {
+        m_planComplete = ParallelBacktracking( state, m_planSize );
+        m_planFinal = m_planComplete;
+        m_timedOut = budgetMs > 0.0 && std::chrono::steady_clock::now() >= m_deadline;
+    }
+    else
+    {
+        ResetContext( m_search, -1, m_planSize );
+        m_planComplete = Backtracking( m_search, state, m_planSize );
+        m_planFinal = m_planComplete;
+        m_timedOut = m_search.m_stopped;
+        m_nodesExpanded += m_search.m_expanded;
+        const std::vector<Operation> &plan = m_planComplete ? m_search.m_plan : m_search.m_partial;
+        m_planSize = m_planComplete ? m_search.m_planSize : m_search.m_partialSize;
+        std::copy( plan.begin(), plan.begin() + m_planSize, m_plan.begin() );
     }
-    active.resize( m_nMotorbikes );
-    for ( int i = 0; i < m_nMotorbikes; ++i ) active[ i ] = m_motorbikes[i].m_isActive;
-    std::vector<int> lanes;
-    lanes.resize( m_nMotorbikes );
-    for ( int i = 0; i < m_nMotorbikes; ++i ) lanes[ i ] = m_motorbikes[ i ].m_y;
-    Backtracking( operations, 0, startX, m_speed, lanes, active, m_nMotorbikes );
 
-    fprintf( stderr, "Operaciones:\n" );
-    for ( int i = 0; i < operations.size(); ++i )
+    TRACE_TURN( "Operaciones%s: %d\n", m_planComplete ? "" : m_timedOut ? " (partial, out of time)" : " (partial)", m_planSize );
+    for ( int i = 0; i < m_planSize; ++i )
     {
-        Operation operation = operations[ i ];
-        fprintf( stderr, "%d) %s\n", i, k_operationStr[ operation ] );
+        Operation operation = m_plan[ i ];
+        TRACE_DETAIL( "%d) %s\n", i, k_operationStr[ operation ] );
         m_operations.push( operation );
     }
+    METRICS_ADD( "bridge.nodes_expanded", m_nodesExpanded - m_reportedNodes );
+    m_reportedNodes = m_nodesExpanded;
 
     return;
 }
 
+// Time budgets per turn, in milliseconds
+const double k_firstTurnBudget = 500.0;
+const double k_turnBudget = 100.0;
+
+#ifndef BRIDGE_NO_MAIN
 int main()
 {
+    InputReader input;
     int M;
     int V;
-    scanf( "%d%d*c", &M, &V );
-    fprintf( stderr, "%d, %d\n", M, V );
+    if ( !input.ReadInt( M ) || !input.ReadInt( V ) ) return 1;
+    TRACE_GAME( "%d, %d\n", M, V );
     IA ia( M, V );
-    ia.ReadMap();
-    ia.Update();
-    ia.CalculateOperations();
+    ia.SetPlanner( IA::OPTIMAL );
+    if ( !ia.ReadMap( input ) || !ia.Update( input ) ) return 1;
+    ia.CalculateOperations( k_firstTurnBudget );
 
     while ( 1 )
     {
         Operation operation = ia.GetNextOperation();
         printf( "%s\n", k_operationStr[ operation ] );
-        ia.Update();
+        fflush( stdout );
+        METRICS_TICK();
+        if ( !ia.Update( input ) ) break;
+        ia.Replan( k_turnBudget );
     }
-}
\ No newline at end of file
+    return 0;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,467 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+// traces are kept in memory only, stderr would dominate the timings
+#define TRACE_ECHO 0
+#define LABYRINTH_NO_MAIN
+#include "TheLabyrinth.cpp"
+
+// Offline simulator for The Labyrinth: hides a generated map behind Kirk's
+// scanner, plays Map against it and reports how the planners behave.
+// Build: g++ -O2 -pthread "TheLabyrinth Simulator.cpp"
+
+struct LabyrinthMap
+{
+    int m_rows;
+    int m_columns;
+    // row after row, no line breaks
+    std::string m_cells;
+    int m_startRow;
+    int m_startColumn;
+    int m_alarm;
+};
+
+class MapGenerator
+{
+public:
+
+    MapGenerator( unsigned int seed ) : m_random( seed ) {}
+
+    // A maze carved on the odd cells, opened up by removing a share of the
+    // cells (loops) and by a few rectangular rooms. The alarm is the
+    // shortest way back from the control room plus up to slack turns.
+    // Returns false when the control room can't be placed
+    bool Generate( int rows, int columns, float loops, int slack, LabyrinthMap &map )
+    {
+        map.m_rows = rows;
+        map.m_columns = columns;
+        map.m_cells.assign( ( size_t ) rows * columns, '#' );
+        std::string &cells = map.m_cells;
+
+        // depth-first maze over the odd cells, with an explicit stack
+        std::vector<int> stack;
+        std::vector<char> visited( cells.size(), 0 );
+        int first = columns + 1;
+        cells[ first ] = '.';
+        visited[ first ] = 1;
+        stack.push_back( first );
+        const int steps[ 4 ] = { -2 * columns, -2, 2, 2 * columns };
+        while ( !stack.empty() )
+        {
+            int pos = stack.back();
+            int row = pos / columns;
+            int column = pos % columns;
+            int options[ 4 ];
+            int nOptions = 0;
+            for ( int d = 0; d < 4; ++d )
+            {
+                int nextRow = row + ( d == 0 ? -2 : d == 3 ? 2 : 0 );
+                int nextColumn = column + ( d == 1 ? -2 : d == 2 ? 2 : 0 );
+                if ( nextRow < 1 || nextRow > rows - 2 || nextColumn < 1 || nextColumn > columns - 2 ) continue;
+                if ( !visited[ pos + steps[ d ] ] ) options[ nOptions++ ] = d;
+            }
+            if ( nOptions == 0 )
+            {
+                stack.pop_back();
+                continue;
+            }
+            int d = options[ std::uniform_int_distribution<int>( 0, nOptions - 1 )( m_random ) ];
+            int next = pos + steps[ d ];
+            cells[ pos + steps[ d ] / 2 ] = '.';
+            cells[ next ] = '.';
+            visited[ next ] = 1;
+            stack.push_back( next );
+        }
+
+        std::uniform_int_distribution<int> anyRow( 1, rows - 2 );
+        std::uniform_int_distribution<int> anyColumn( 1, columns - 2 );
+        long long nOpened = ( long long ) ( loops * ( rows - 2 ) * ( columns - 2 ) );
+        for ( long long i = 0; i < nOpened; ++i ) cells[ ( size_t ) anyRow( m_random ) * columns + anyColumn( m_random ) ] = '.';
+
+        int nRooms = std::max( 2, ( rows * columns ) / 600 );
+        std::uniform_int_distribution<int> roomHeight( 3, 6 );
+        std::uniform_int_distribution<int> roomWidth( 3, 10 );
+        for ( int i = 0; i < nRooms; ++i )
+        {
+            int top = anyRow( m_random );
+            int left = anyColumn( m_random );
+            int bottom = std::min( top + roomHeight( m_random ), rows - 1 );
+            int right = std::min( left + roomWidth( m_random ), columns - 1 );
+            for ( int row = top; row < bottom; ++row )
+            {
+                for ( int column = left; column < right; ++column ) cells[ ( size_t ) row * columns + column ] = '.';
+            }
+        }
+
+        std::vector<int> floor;
+        for ( int pos = 0; pos < ( int ) cells.size(); ++pos )
+        {
+            if ( cells[ pos ] == '.' ) floor.push_back( pos );
+        }
+        int start = floor[ std::uniform_int_distribution<size_t>( 0, floor.size() - 1 )( m_random ) ];
+
+        // the control room goes anywhere reachable from the start
+        std::vector<int> distance( cells.size(), -1 );
+        std::vector<int> reachable;
+        size_t head = 0;
+        distance[ start ] = 0;
+        reachable.push_back( start );
+        const int neighbors[ 4 ] = { -columns, -1, 1, columns };
+        while ( head < reachable.size() )
+        {
+            int pos = reachable[ head++ ];
+            for ( int d = 0; d < 4; ++d )
+            {
+                int next = pos + neighbors[ d ];
+                if ( cells[ next ] == '.' && distance[ next ] < 0 )
+                {
+                    distance[ next ] = distance[ pos ] + 1;
+                    reachable.push_back( next );
+                }
+            }
+        }
+        if ( reachable.size() < 2 ) return false;
+        int controlRoom = reachable[ std::uniform_int_distribution<size_t>( 1, reachable.size() - 1 )( m_random ) ];
+
+        cells[ start ] = 'T';
+        cells[ controlRoom ] = 'C';
+        map.m_startRow = start / columns;
+        map.m_startColumn = start % columns;
+        map.m_alarm = distance[ controlRoom ] + std::uniform_int_distribution<int>( 0, slack )( m_random );
+        return true;
+    }
+
+private:
+
+    std::mt19937 m_random;
+};
+
+class Referee
+{
+public:
+
+    static const int k_viewRadius = 2;
+
+    enum Result
+    {
+        PLAYING = 0,
+        WON,
+        CRASHED,
+        OUT_OF_FUEL,
+        ALARM,
+        STUCK
+    };
+
+    Referee( const LabyrinthMap &map, int fuel )
+        : m_map( map )
+        , m_row( map.m_startRow )
+        , m_column( map.m_startColumn )
+        , m_fuel( fuel )
+        , m_alarmLeft( -1 )
+        , m_turn( 0 )
+        , m_result( PLAYING )
+    {
+        // the rows in the text format the game sends
+        m_view.assign( ( size_t ) map.m_rows * ( map.m_columns + 1 ), '?' );
+        for ( int row = 0; row < map.m_rows; ++row ) m_view[ ( size_t ) row * ( map.m_columns + 1 ) + map.m_columns ] = '\n';
+        Reveal();
+    }
+
+    // what Kirk has seen so far, in the layout Map::Update reads
+    const char *GetView() const { return m_view.data(); }
+
+    // Returns false when the game is over
+    bool Apply( Direction direction )
+    {
+        ++m_turn;
+        m_row += direction == UP ? -1 : direction == DOWN ? 1 : 0;
+        m_column += direction == LEFT ? -1 : direction == RIGHT ? 1 : 0;
+        char cell = m_map.m_cells[ ( size_t ) m_row * m_map.m_columns + m_column ];
+        --m_fuel;
+        if ( m_alarmLeft >= 0 ) --m_alarmLeft;
+        if ( cell == 'C' && m_alarmLeft < 0 ) m_alarmLeft = m_map.m_alarm;
+
+        if ( cell == '#' ) m_result = CRASHED;
+        else if ( cell == 'T' && m_alarmLeft >= 0 ) m_result = WON;
+        else if ( m_alarmLeft == 0 ) m_result = ALARM;
+        else if ( m_fuel <= 0 ) m_result = OUT_OF_FUEL;
+        Reveal();
+        return m_result == PLAYING;
+    }
+
+    void Stuck() { m_result = STUCK; }
+
+    int GetRow() const { return m_row; }
+    int GetColumn() const { return m_column; }
+    int GetTurn() const { return m_turn; }
+    Result GetResult() const { return m_result; }
+
+private:
+
+    void Reveal()
+    {
+        int top = std::max( m_row - k_viewRadius, 0 );
+        int bottom = std::min( m_row + k_viewRadius, m_map.m_rows - 1 );
+        int left = std::max( m_column - k_viewRadius, 0 );
+        int right = std::min( m_column + k_viewRadius, m_map.m_columns - 1 );
+        for ( int row = top; row <= bottom; ++row )
+        {
+            for ( int column = left; column <= right; ++column )
+            {
+                m_view[ ( size_t ) row * ( m_map.m_columns + 1 ) + column ] = m_map.m_cells[ ( size_t ) row * m_map.m_columns + column ];
+            }
+        }
+    }
+
+    const LabyrinthMap &m_map;
+    std::string m_view;
+    int m_row;
+    int m_column;
+    int m_fuel;
+    int m_alarmLeft;
+    int m_turn;
+    Result m_result;
+};
+
+const char *k_resultStr[] =
+{
+    "playing",
+    "won",
+    "crashed",
+    "out of fuel",
+    "alarm",
+    "stuck"
+};
+
+struct GameResult
+{
+    Referee::Result m_result;
+    int m_turns;
+    int m_searches;
+    unsigned long long m_nodes;
+    unsigned long long m_knownPathNodes;
+    int m_pathMismatches;
+    double m_planningMs;
+};
+
+struct PlayOptions
+{
+    int m_fuel;
+    Map::ExplorationMode m_explorationMode;
+    Map::PathMode m_pathMode;
+    bool m_homeField;
+    bool m_checkPaths;
+};
+
+// Appends the time spent in Map for every turn to turnMs
+GameResult Play( const LabyrinthMap &map, const PlayOptions &options, std::vector<double> &turnMs )
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Map shipMap( map.m_columns, map.m_rows, map.m_alarm );
+    shipMap.SetExplorationMode( options.m_explorationMode );
+    shipMap.SetHomeField( options.m_homeField );
+    shipMap.SetPathMode( options.m_pathMode );
+    shipMap.SetCheckPaths( options.m_checkPaths );
+
+    GameResult result;
+    result.m_planningMs = 0.0;
+
+    Referee referee( map, options.m_fuel );
+    bool playing = true;
+    while ( playing )
+    {
+        Clock::time_point start = Clock::now();
+        shipMap.Update( referee.GetRow(), referee.GetColumn(), referee.GetView() );
+        bool hasStep = shipMap.HasStep();
+        Direction direction = hasStep ? shipMap.GetStep() : UP;
+        double ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+        result.m_planningMs += ms;
+        turnMs.push_back( ms );
+        METRICS_TICK();
+
+        if ( !hasStep )
+        {
+            referee.Stuck();
+            break;
+        }
+        playing = referee.Apply( direction );
+    }
+
+    result.m_result = referee.GetResult();
+    result.m_turns = referee.GetTurn();
+    result.m_searches = shipMap.GetSearches();
+    result.m_nodes = shipMap.GetNodesExpanded();
+    result.m_knownPathNodes = shipMap.GetKnownPathNodes();
+    result.m_pathMismatches = shipMap.GetPathMismatches();
+    return result;
+}
+
+double Mean( const std::vector<double> &values )
+{
+    double sum = 0.0;
+    for ( size_t i = 0; i < values.size(); ++i ) sum += values[ i ];
+    return values.empty() ? 0.0 : sum / values.size();
+}
+
+double Percentile( std::vector<double> values, double p )
+{
+    if ( values.empty() ) return 0.0;
+    std::sort( values.begin(), values.end() );
+    return values[ std::min( values.size() - 1, ( size_t ) ( p * values.size() ) ) ];
+}
+
+// Usage: "TheLabyrinth Simulator" [options] 2>/dev/null
+//   --seeds <n>            maps to play (100)
+//   --seed <s>             first seed (1)
+//   --rows <R>             map height, 5 to 4000 (20)
+//   --columns <C>          map width, 5 to 4000 (30)
+//   --loops <p>            share of cells opened after carving the maze (0.1)
+//   --slack <turns>        alarm turns on top of the shortest way back (10)
+//   --fuel <moves>         moves before the jetpack runs dry (1200)
+//   --exploration <mode>   nearest or gain (gain)
+//   --no-home-field        don't keep the distance field from the start, the
+//                          way back then comes from the bidirectional search
+//   --path <mode>          known paths with plain or jps expansion (jps)
+//   --check-paths          also run the plain known path search and count
+//                          the lengths that differ
+//   --verbose              one line per map
+//   --traces               the last traces kept of every map not won
+int main( int argc, char **argv )
+{
+    int nSeeds = 100;
+    unsigned int firstSeed = 1;
+    int rows = 20;
+    int columns = 30;
+    float loops = 0.1f;
+    int slack = 10;
+    PlayOptions options;
+    options.m_fuel = 1200;
+    options.m_explorationMode = Map::INFORMATION_GAIN;
+    options.m_pathMode = Map::JUMP_POINTS;
+    options.m_homeField = true;
+    options.m_checkPaths = false;
+    bool verbose = false;
+    bool traces = false;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const char *value = i + 1 < argc ? argv[ i + 1 ] : "";
+        if ( std::strcmp( argv[ i ], "--verbose" ) == 0 ) { verbose = true; continue; }
+        if ( std::strcmp( argv[ i ], "--no-home-field" ) == 0 ) { options.m_homeField = false; continue; }
+        if ( std::strcmp( argv[ i ], "--traces" ) == 0 ) { traces = true; continue; }
+        if ( std::strcmp( argv[ i ], "--check-paths" ) == 0 ) { options.m_checkPaths = true; continue; }
+        if ( std::strcmp( argv[ i ], "--seeds" ) == 0 ) nSeeds = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--seed" ) == 0 ) firstSeed = ( unsigned int ) std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--rows" ) == 0 ) rows = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--columns" ) == 0 ) columns = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--loops" ) == 0 ) loops = ( float ) std::atof( value );
+        else if ( std::strcmp( argv[ i ], "--slack" ) == 0 ) slack = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--fuel" ) == 0 ) options.m_fuel = std::atoi( value );
+        else if ( std::strcmp( argv[ i ], "--exploration" ) == 0 )
+        {
+            if ( std::strcmp( value, "nearest" ) == 0 ) options.m_explorationMode = Map::NEAREST_FRONTIER;
+            else if ( std::strcmp( value, "gain" ) == 0 ) options.m_explorationMode = Map::INFORMATION_GAIN;
+            else
+            {
+                fprintf( stderr, "Unknown exploration mode: %s\n", value );
+                return 1;
+            }
+        }
+        else if ( std::strcmp( argv[ i ], "--path" ) == 0 )
+        {
+            if ( std::strcmp( value, "plain" ) == 0 ) options.m_pathMode = Map::PLAIN;
+            else if ( std::strcmp( value, "jps" ) == 0 ) options.m_pathMode = Map::JUMP_POINTS;
+            else
+            {
+                fprintf( stderr, "Unknown path mode: %s\n", value );
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf( stderr, "Unknown option: %s\n", argv[ i ] );
+            return 1;
+        }
+        ++i;
+    }
+    rows = std::min( std::max( rows, 5 ), 4000 );
+    columns = std::min( std::max( columns, 5 ), 4000 );
+    slack = std::max( slack, 0 );
+
+    int played = 0;
+    int results[ Referee::STUCK + 1 ] = { 0 };
+    int searches = 0;
+    unsigned long long nodes = 0;
+    unsigned long long knownPathNodes = 0;
+    int pathMismatches = 0;
+    std::vector<double> turnMs;
+    std::vector<double> wonTurns;
+    std::vector<double> nodesPerSearch;
+    for ( int s = 0; s < nSeeds; ++s )
+    {
+        unsigned int seed = firstSeed + s;
+        LabyrinthMap map;
+        MapGenerator generator( seed );
+        if ( !generator.Generate( rows, columns, loops, slack, map ) )
+        {
+            if ( verbose ) printf( "seed %u: no room for the control room\n", seed );
+            continue;
+        }
+        GetTraceRing().Clear();
+        GameResult result = Play( map, options, turnMs );
+
+        ++played;
+        ++results[ result.m_result ];
+        if ( result.m_result == Referee::WON ) wonTurns.push_back( result.m_turns );
+        searches += result.m_searches;
+        nodes += result.m_nodes;
+        knownPathNodes += result.m_knownPathNodes;
+        pathMismatches += result.m_pathMismatches;
+        if ( result.m_searches ) nodesPerSearch.push_back( ( double ) result.m_nodes / result.m_searches );
+
+        if ( verbose )
+        {
+            printf( "seed %u: %s in %d turns, alarm %d, %.3f ms planning, %d searches, %llu nodes\n",
+                seed, k_resultStr[ result.m_result ], result.m_turns, map.m_alarm,
+                result.m_planningMs, result.m_searches, result.m_nodes );
+        }
+        if ( traces && result.m_result != Referee::WON )
+        {
+            printf( "seed %u: %s, last traces:\n", seed, k_resultStr[ result.m_result ] );
+            GetTraceRing().Dump( stdout );
+        }
+    }
+
+    printf( "%d maps of %dx%d, loops %.3f, slack %d, fuel %d, exploration %s, path %s, home field %s\n",
+        played, rows, columns, loops, slack, options.m_fuel,
+        options.m_explorationMode == Map::NEAREST_FRONTIER ? "nearest" : "gain",
+        options.m_pathMode == Map::PLAIN ? "plain" : "jps",
+        options.m_homeField ? "on" : "off" );
+    printf( "success: %d/%d (%.1f%%)", results[ Referee::WON ], played, played ? 100.0 * results[ Referee::WON ] / played : 0.0 );
+    for ( int r = Referee::CRASHED; r <= Referee::STUCK; ++r )
+    {
+        if ( results[ r ] ) printf( ", %s: %d", k_resultStr[ r ], results[ r ] );
+    }
+    printf( "\n" );
+    if ( !wonTurns.empty() )
+    {
+        printf( "turns to completion: mean %.1f, p50 %.0f, p95 %.0f, max %.0f\n",
+            Mean( wonTurns ), Percentile( wonTurns, 0.5 ), Percentile( wonTurns, 0.95 ), Percentile( wonTurns, 1.0 ) );
+    }
+    printf( "turn latency: mean %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        Mean( turnMs ), Percentile( turnMs, 0.5 ), Percentile( turnMs, 0.95 ), Percentile( turnMs, 0.99 ), Percentile( turnMs, 1.0 ) );
+    printf( "nodes expanded: %.1f per search (%d searches), per map p50 %.1f, p95 %.1f\n",
+        searches ? ( double ) nodes / searches : 0.0, searches, Percentile( nodesPerSearch, 0.5 ), Percentile( nodesPerSearch, 0.95 ) );
+    printf( "known path nodes expanded: %llu", knownPathNodes );
+    if ( options.m_checkPaths ) printf( ", %d lengths differ from the plain search", pathMismatches );
+    printf( "\n" );
+
+    return 0;
+}
\ No newline at end of file
@@ -2,7 +2,16 @@
 #include <queue>
 #include <stack>
 #include <cmath>
+#include <algorithm>
+#include <string>
 #include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "InputReader.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "WorkerPool.h"
 
 // https://www.codingame.com/training/hard/the-labyrinth
 
@@ -33,36 +42,721 @@ struct Point
     bool operator==( const Point &other ) const { return x == other.x && y == other.y; }
 };
 
+// The text map at two bits per cell, newline column included so positions
+// match the buffer. Built from each turn's buffer with SSE2 compares, then
+// scanned 32 cells per 64-bit word.
+class PackedGrid
+{
+public:
+    enum Cell
+    {
+        FLOOR = 0,
+        WALL,       // '#' and the newlines
+        UNKNOWN,    // '?'
+        SPECIAL     // 'T' and 'C'
+    };
+
+    PackedGrid( int size, Cell fill ) : m_size( size ), m_words( ( size + 31 ) / 32 )
+    {
+        m_cells = new unsigned long long[ m_words ];
+        for ( int i = 0; i < m_words; ++i ) m_cells[ i ] = k_even * fill;
+        // the padding after the last cell reads as floor
+        if ( size % 32 ) m_cells[ m_words - 1 ] &= ( 1ULL << ( size % 32 * 2 ) ) - 1;
+    }
+    ~PackedGrid()
+    {
+        delete[] m_cells;
+    }
+
+    void Classify( const char *buffer );
+    Cell Get( int pos ) const { return ( Cell ) ( ( m_cells[ pos >> 5 ] >> ( ( pos & 31 ) * 2 ) ) & 3 ); }
+    int CountUnknown() const;
+    // first SPECIAL cell at or after pos, -1 if there is none
+    int FindSpecial( int pos ) const;
+    // appends the cells whose class differs from other
+    void Diff( const PackedGrid &other, std::vector<int> &changed ) const;
+    void Swap( PackedGrid &other ) { std::swap( m_cells, other.m_cells ); }
+
+private:
+
+    static const unsigned long long k_even = 0x5555555555555555ULL;
+
+    static Cell Classify( char c )
+    {
+        if ( c == '#' || c == '\n' ) return WALL;
+        if ( c == '?' ) return UNKNOWN;
+        if ( c == 'T' || c == 'C' ) return SPECIAL;
+        return FLOOR;
+    }
+    // moves the 16 low bits to the even bits of the result
+    static unsigned long long Spread( unsigned long long x )
+    {
+        x = ( x | ( x << 8 ) ) & 0x00FF00FFULL;
+        x = ( x | ( x << 4 ) ) & 0x0F0F0F0FULL;
+        x = ( x | ( x << 2 ) ) & 0x33333333ULL;
+        x = ( x | ( x << 1 ) ) & 0x55555555ULL;
+        return x;
+    }
+
+    unsigned long long *m_cells;
+    int m_size;
+    int m_words;
+};
+
+void PackedGrid::Classify( const char *buffer )
+{
+    int full = m_size / 32;
+#ifdef __SSE2__
+    const __m128i wall = _mm_set1_epi8( '#' );
+    const __m128i newline = _mm_set1_epi8( '\n' );
+    const __m128i unknown = _mm_set1_epi8( '?' );
+    const __m128i start = _mm_set1_epi8( 'T' );
+    const __m128i controlRoom = _mm_set1_epi8( 'C' );
+    for ( int w = 0; w < full; ++w )
+    {
+        unsigned long long word = 0;
+        for ( int half = 0; half < 2; ++half )
+        {
+            __m128i v = _mm_loadu_si128( ( const __m128i * ) ( buffer + w * 32 + half * 16 ) );
+            __m128i special = _mm_or_si128( _mm_cmpeq_epi8( v, start ), _mm_cmpeq_epi8( v, controlRoom ) );
+            __m128i low = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, wall ), _mm_cmpeq_epi8( v, newline ) ), special );
+            __m128i high = _mm_or_si128( _mm_cmpeq_epi8( v, unknown ), special );
+            unsigned long long bits = Spread( _mm_movemask_epi8( low ) ) | ( Spread( _mm_movemask_epi8( high ) ) << 1 );
+            word |= bits << ( half * 32 );
+        }
+        m_cells[ w ] = word;
+    }
+#else
+    for ( int w = 0; w < full; ++w )
+    {
+        unsigned long long word = 0;
+        for ( int i = 0; i < 32; ++i ) word |= ( unsigned long long ) Classify( buffer[ w * 32 + i ] ) << ( i * 2 );
+        m_cells[ w ] = word;
+    }
+#endif
+    if ( full < m_words )
+    {
+        unsigned long long word = 0;
+        for ( int i = full * 32; i < m_size; ++i ) word |= ( unsigned long long ) Classify( buffer[ i ] ) << ( ( i & 31 ) * 2 );
+        m_cells[ full ] = word;
+    }
+}
+
+int PackedGrid::CountUnknown() const
+{
+    int count = 0;
+    for ( int w = 0; w < m_words; ++w )
+    {
+        unsigned long long word = m_cells[ w ];
+        count += __builtin_popcountll( ~word & ( word >> 1 ) & k_even );
+    }
+    return count;
+}
+
+int PackedGrid::FindSpecial( int pos ) const
+{
+    if ( pos >= m_size ) return -1;
+    // ignore the cells before pos in its word
+    unsigned long long skip = ~0ULL << ( ( pos & 31 ) * 2 );
+    for ( int w = pos >> 5; w < m_words; ++w, skip = ~0ULL )
+    {
+        unsigned long long word = m_cells[ w ];
+        unsigned long long special = word & ( word >> 1 ) & k_even & skip;
+        if ( special ) return w * 32 + __builtin_ctzll( special ) / 2;
+    }
+    return -1;
+}
+
+void PackedGrid::Diff( const PackedGrid &other, std::vector<int> &changed ) const
+{
+    for ( int w = 0; w < m_words; ++w )
+    {
+        unsigned long long diff = m_cells[ w ] ^ other.m_cells[ w ];
+        diff = ( diff | ( diff >> 1 ) ) & k_even;
+        while ( diff )
+        {
+            changed.push_back( w * 32 + __builtin_ctzll( diff ) / 2 );
+            diff &= diff - 1;
+        }
+    }
+}
+
+// Per cell integers that can all be reset to one value in O(1): an entry
+// only holds its own value while its stamp matches the current generation.
+class StampedArray
+{
+public:
+    StampedArray( int size ) : m_size( size ), m_generation( 1 ), m_default( 0 )
+    {
+        m_cells = new Cell[ size ]();
+    }
+    ~StampedArray()
+    {
+        delete[] m_cells;
+    }
+
+    void Reset( int value )
+    {
+        m_default = value;
+        if ( ++m_generation == 0 )
+        {
+            // the stamps wrapped around, forget them for real
+            for ( int i = 0; i < m_size; ++i ) m_cells[ i ].stamp = 0;
+            m_generation = 1;
+        }
+    }
+    int Get( int pos ) const { return m_cells[ pos ].stamp == m_generation ? m_cells[ pos ].value : m_default; }
+    void Set( int pos, int value )
+    {
+        m_cells[ pos ].stamp = m_generation;
+        m_cells[ pos ].value = value;
+    }
+
+private:
+
+    struct Cell
+    {
+        unsigned int stamp;
+        int value;
+    };
+
+    Cell *m_cells;
+    int m_size;
+    unsigned int m_generation;
+    int m_default;
+};
+
+// Scratch arrays shared by the one-shot searches of Map, so starting a
+// search doesn't touch the whole grid
+struct SearchWorkspace
+{
+    SearchWorkspace( int size ) : m_parents( size ), m_pathSize( size ) {}
+
+    // parents read as -1 and path sizes as unreached until set
+    void NewSearch( int unreached )
+    {
+        m_parents.Reset( -1 );
+        m_pathSize.Reset( unreached );
+    }
+
+    StampedArray m_parents;
+    StampedArray m_pathSize;
+};
+
+// Priority queue for small non negative integer keys: one intrusive doubly
+// linked list per key, indexed by cell, so push, pop and decrease-key are
+// O(1) (pop amortised over the scan of empty buckets) and nothing is
+// allocated while searching. Keys may go below the last popped one.
+class BucketQueue
+{
+public:
+    BucketQueue( int size, int maxKey )
+        : m_maxKey( maxKey )
+        , m_min( maxKey + 1 )
+        , m_max( -1 )
+        , m_count( 0 )
+    {
+        m_head = new int[ maxKey + 1 ];
+        m_next = new int[ size ];
+        m_prev = new int[ size ];
+        m_key = new int[ size ];
+        for ( int i = 0; i <= maxKey; ++i ) m_head[ i ] = -1;
+        for ( int i = 0; i < size; ++i ) m_key[ i ] = -1;
+    }
+    ~BucketQueue()
+    {
+        delete[] m_head;
+        delete[] m_next;
+        delete[] m_prev;
+        delete[] m_key;
+    }
+
+    bool Empty() const { return m_count == 0; }
+    int Size() const { return m_count; }
+    bool Contains( int pos ) const { return m_key[ pos ] >= 0; }
+
+    // inserts pos, or moves it to key when it is already queued
+    void Push( int pos, int key )
+    {
+        if ( key > m_maxKey ) key = m_maxKey;
+        if ( Contains( pos ) ) Unlink( pos );
+        ++m_count;
+        m_key[ pos ] = key;
+        m_prev[ pos ] = -1;
+        m_next[ pos ] = m_head[ key ];
+        if ( m_head[ key ] >= 0 ) m_prev[ m_head[ key ] ] = pos;
+        m_head[ key ] = pos;
+        m_min = std::min( m_min, key );
+        m_max = std::max( m_max, key );
+    }
+    int TopKey()
+    {
+        while ( m_head[ m_min ] < 0 ) ++m_min;
+        return m_min;
+    }
+    // removes and returns the cell with the lowest key, the last one pushed among equals
+    int Pop( int &key )
+    {
+        while ( m_head[ m_min ] < 0 ) ++m_min;
+        int pos = m_head[ m_min ];
+        key = m_min;
+        Unlink( pos );
+        return pos;
+    }
+    void Erase( int pos )
+    {
+        if ( Contains( pos ) ) Unlink( pos );
+    }
+    // O(queued cells + used key range)
+    void Clear()
+    {
+        for ( int key = m_min; key <= m_max; ++key )
+        {
+            for ( int pos = m_head[ key ]; pos >= 0; pos = m_next[ pos ] ) m_key[ pos ] = -1;
+            m_head[ key ] = -1;
+        }
+        m_min = m_maxKey + 1;
+        m_max = -1;
+        m_count = 0;
+    }
+
+private:
+
+    void Unlink( int pos )
+    {
+        int key = m_key[ pos ];
+        if ( m_prev[ pos ] >= 0 ) m_next[ m_prev[ pos ] ] = m_next[ pos ];
+        else m_head[ key ] = m_next[ pos ];
+        if ( m_next[ pos ] >= 0 ) m_prev[ m_next[ pos ] ] = m_prev[ pos ];
+        m_key[ pos ] = -1;
+        --m_count;
+    }
+
+    int *m_head;
+    int *m_next;
+    int *m_prev;
+    int *m_key;
+    int m_maxKey;
+    int m_min;
+    int m_max;
+    int m_count;
+};
+
+// Known open cells with at least one unknown neighbour. Cells are added and
+// removed in O(1) so the set can follow the few cells revealed each turn.
+class FrontierSet
+{
+public:
+    FrontierSet( int size )
+    {
+        m_contains = new char[ size ]();
+        m_index = new int[ size ];
+    }
+    ~FrontierSet()
+    {
+        delete[] m_contains;
+        delete[] m_index;
+    }
+
+    void Insert( int pos )
+    {
+        if ( m_contains[ pos ] ) return;
+        m_contains[ pos ] = 1;
+        m_index[ pos ] = ( int ) m_cells.size();
+        m_cells.push_back( pos );
+    }
+    void Erase( int pos )
+    {
+        if ( !m_contains[ pos ] ) return;
+        int last = m_cells.back();
+        m_cells[ m_index[ pos ] ] = last;
+        m_index[ last ] = m_index[ pos ];
+        m_cells.pop_back();
+        m_contains[ pos ] = 0;
+    }
+    bool Contains( int pos ) const { return m_contains[ pos ] != 0; }
+    const char *GetMembership() const { return m_contains; }
+    const std::vector<int> &GetCells() const { return m_cells; }
+
+private:
+    char *m_contains;
+    int *m_index;
+    std::vector<int> m_cells;
+};
+
+// D* Lite over the 4-connected grid: walls block, unknown cells block unless
+// unknownPassable, and every other cell costs 1. The search grows from the
+// goal towards Kirk, so the tree stays valid while he walks and each call
+// only repairs the cells revealed since the previous one.
+class DStarLite
+{
+public:
+    DStarLite( const PackedGrid &grid, int width, int height, bool unknownPassable )
+        : m_grid( grid )
+        , m_realSize( height * width + height )
+        , m_offset( width + 1 )
+        , m_g( m_realSize )
+        , m_rhs( m_realSize )
+        , m_unknownPassable( unknownPassable )
+        , m_blocked( -1 )
+        , m_goals( 0 )
+        , m_goal( -1 )
+        , m_last( -1 )
+        , m_km( 0 )
+        , m_nodesExpanded( 0 )
+        , m_queuePushes( 0 )
+        , m_searches( 0 )
+    {
+        m_neighbors[ UP ] = -m_offset;
+        m_neighbors[ LEFT ] = -1;
+        m_neighbors[ RIGHT ] = 1;
+        m_neighbors[ DOWN ] = m_offset;
+    }
+
+    void SetGoal( int goal );
+    // Every flagged cell is a goal. The flags may change between calls as
+    // long as the cells involved are reported through CellsChanged
+    void SetGoals( const char *goals );
+    void ClearGoal();
+    // treats one more cell as a wall
+    void Block( int pos );
+    int GetGoal() const { return m_goal; }
+    bool HasGoal() const { return m_goal >= 0 || m_goals; }
+    void CellsChanged( const std::vector<int> &cells );
+    // false when no goal can be reached from start
+    bool ComputePath( int start );
+    // distance from pos to the nearest goal as of the last ComputePath
+    int GetDistance( int pos ) const { return m_g.Get( pos ); }
+    // next cell of the shortest path from pos
+    int GetNext( int pos ) const;
+    unsigned long long GetNodesExpanded() const { return m_nodesExpanded; }
+    unsigned long long GetQueuePushes() const { return m_queuePushes; }
+    int GetSearches() const { return m_searches; }
+
+private:
+
+    static const int k_infinite = 1 << 29;
+
+    struct Key
+    {
+        int k1;
+        int k2;
+
+        bool operator<( const Key &other ) const { return k1 < other.k1 || ( k1 == other.k1 && k2 < other.k2 ); }
+    };
+
+    struct Node
+    {
+        int position;
+        Key key;
+
+        bool operator<( const Node &other ) const { return other.key < key; }
+    };
+
+    bool IsGoal( int pos ) const { return m_goals ? m_goals[ pos ] != 0 : pos == m_goal; }
+    bool Passable( int pos ) const
+    {
+        if ( pos < 0 || pos >= m_realSize || pos == m_blocked ) return false;
+        PackedGrid::Cell cell = m_grid.Get( pos );
+        return cell != PackedGrid::WALL && ( m_unknownPassable || cell != PackedGrid::UNKNOWN );
+    }
+    int Heuristic( int pos1, int pos2 ) const
+    {
+        int y1 = pos1 / m_offset;
+        int y2 = pos2 / m_offset;
+        return std::abs( y1 - y2 ) + std::abs( ( pos1 - y1 * m_offset ) - ( pos2 - y2 * m_offset ) );
+    }
+    Key CalculateKey( int pos ) const
+    {
+        Key key;
+        key.k2 = std::min( m_g.Get( pos ), m_rhs.Get( pos ) );
+        key.k1 = key.k2 + Heuristic( m_last, pos ) + m_km;
+        return key;
+    }
+    void Push( int pos )
+    {
+        Node node;
+        node.position = pos;
+        node.key = CalculateKey( pos );
+        m_queue.push( node );
+        ++m_queuePushes;
+    }
+    void Reset();
+    void UpdateVertex( int pos );
+
+    const PackedGrid &m_grid;
+    int m_realSize;
+    int m_offset;
+    int m_neighbors[ DSIZE ];
+    StampedArray m_g;
+    StampedArray m_rhs;
+
+    bool m_unknownPassable;
+    int m_blocked;
+    const char *m_goals;
+    int m_goal;
+    int m_last;
+    int m_km;
+    unsigned long long m_nodesExpanded;
+    unsigned long long m_queuePushes;
+    int m_searches;
+    std::priority_queue < Node > m_queue;
+    std::vector<int> m_changed;
+};
+
+void DStarLite::Reset()
+{
+    ClearGoal();
+    m_g.Reset( k_infinite );
+    m_rhs.Reset( k_infinite );
+}
+
+void DStarLite::SetGoal( int goal )
+{
+    Reset();
+    m_goal = goal;
+    m_rhs.Set( goal, 0 );
+}
+
+void DStarLite::SetGoals( const char *goals )
+{
+    Reset();
+    m_goals = goals;
+}
+
+void DStarLite::ClearGoal()
+{
+    m_queue = std::priority_queue < Node >();
+    m_changed.clear();
+    m_goals = 0;
+    m_goal = -1;
+    m_last = -1;
+    m_km = 0;
+}
+
+void DStarLite::Block( int pos )
+{
+    m_blocked = pos;
+    if ( HasGoal() ) m_changed.push_back( pos );
+}
+
+void DStarLite::CellsChanged( const std::vector<int> &cells )
+{
+    // nothing to repair until there is a tree
+    if ( !HasGoal() ) return;
+    m_changed.insert( m_changed.end(), cells.begin(), cells.end() );
+}
+
+void DStarLite::UpdateVertex( int pos )
+{
+    if ( pos < 0 || pos >= m_realSize ) return;
+    if ( IsGoal( pos ) && Passable( pos ) )
+    {
+        m_rhs.Set( pos, 0 );
+    }
+    else
+    {
+        int rhs = k_infinite;
+        if ( Passable( pos ) )
+        {
+            for ( int d = UP; d < DSIZE; ++d )
+            {
+                int p = pos + m_neighbors[ d ];
+                if ( Passable( p ) ) rhs = std::min( rhs, m_g.Get( p ) + 1 );
+            }
+        }
+        m_rhs.Set( pos, rhs );
+    }
+    // stale entries are skipped when popped
+    if ( m_g.Get( pos ) != m_rhs.Get( pos ) ) Push( pos );
+}
+
+bool DStarLite::ComputePath( int start )
+{
+    if ( !HasGoal() ) return false;
+
+    if ( m_last < 0 )
+    {
+        m_last = start;
+        if ( m_goals )
+        {
+            for ( int i = 0; i < m_realSize; ++i )
+            {
+                if ( !m_goals[ i ] || !Passable( i ) ) continue;
+                m_rhs.Set( i, 0 );
+                Push( i );
+            }
+        }
+        else
+        {
+            Push( m_goal );
+        }
+    }
+    // keys already queued were computed from the previous position
+    m_km += Heuristic( m_last, start );
+    m_last = start;
+
+    for ( size_t i = 0; i < m_changed.size(); ++i )
+    {
+        int pos = m_changed[ i ];
+        UpdateVertex( pos );
+        for ( int d = UP; d < DSIZE; ++d ) UpdateVertex( pos + m_neighbors[ d ] );
+    }
+    m_changed.clear();
+
+    int expanded = 0;
+    while ( !m_queue.empty() )
+    {
+        Node node = m_queue.top();
+        int pos = node.position;
+        if ( m_g.Get( pos ) == m_rhs.Get( pos ) )
+        {
+            m_queue.pop();
+            continue;
+        }
+
+        Key key = CalculateKey( pos );
+        if ( key < node.key )
+        {
+            // a newer entry for this cell is queued
+            m_queue.pop();
+            continue;
+        }
+        if ( !( node.key < CalculateKey( start ) ) && m_g.Get( start ) == m_rhs.Get( start ) ) break;
+
+        m_queue.pop();
+        if ( node.key < key )
+        {
+            node.key = key;
+            m_queue.push( node );
+            ++m_queuePushes;
+            continue;
+        }
+
+        ++expanded;
+        if ( m_g.Get( pos ) > m_rhs.Get( pos ) )
+        {
+            m_g.Set( pos, m_rhs.Get( pos ) );
+        }
+        else
+        {
+            m_g.Set( pos, k_infinite );
+            UpdateVertex( pos );
+        }
+        for ( int d = UP; d < DSIZE; ++d ) UpdateVertex( pos + m_neighbors[ d ] );
+    }
+    TRACE_TURN( "D* Lite: %d nodes expanded, distance %d\n", expanded, m_g.Get( start ) );
+    m_nodesExpanded += expanded;
+    ++m_searches;
+
+    return m_g.Get( start ) < k_infinite;
+}
+
+int DStarLite::GetNext( int pos ) const
+{
+    int next = -1;
+    int best = k_infinite;
+    for ( int d = UP; d < DSIZE; ++d )
+    {
+        int p = pos + m_neighbors[ d ];
+        if ( Passable( p ) && m_g.Get( p ) + 1 < best )
+        {
+            best = m_g.Get( p ) + 1;
+            next = p;
+        }
+    }
+    return next;
+}
+
 class Map
 {
 public:
-    Map( char *buffer, int width, int height )
-        : m_map( buffer ), m_size( width, height )
+    Map( int width, int height, int alarmTimer )
+        : m_map( 0 ), m_size( width, height )
         , m_realSize( height * width + height )
         , m_offset( width + 1 )
         , m_state( START )
         , m_kirk( -1, -1 )
         , m_startPosition( -1, -1 )
         , m_controlRoom( -1, -1 )
+        , m_grid( m_realSize, PackedGrid::UNKNOWN )
+        , m_lastGrid( m_realSize, PackedGrid::UNKNOWN )
+        , m_planner( m_grid, width, height, true )
+        , m_frontier( m_realSize )
+        , m_explorer( m_grid, width, height, false )
+        , m_search( m_realSize )
+        , m_openSet( m_realSize, m_realSize + width + height + 6 )
+        , m_backSearch( m_realSize )
+        , m_backSet( m_realSize, m_realSize + width + height )
+        , m_homeDistance( m_realSize )
+        , m_homeField( true )
+        , m_alarmTimer( alarmTimer )
+        , m_turn( 0 )
+        , m_alarmTurn( -1 )
+        , m_explorationMode( INFORMATION_GAIN )
+        , m_pathMode( JUMP_POINTS )
+        , m_checkPaths( false )
+        , m_pathMismatches( 0 )
+        , m_knownPathNodes( 0 )
+        , m_nodesExpanded( 0 )
+        , m_queuePushes( 0 )
+        , m_searches( 0 )
+        , m_reportedNodes( 0 )
+        , m_reportedPushes( 0 )
+        , m_reportedSearches( 0 )
     {
-        fprintf( stderr, "## Map\nSize: %d, offset: %d\n##\n", m_realSize, m_offset );
-        m_parents = new int[ m_realSize ];
-        m_pathSize = new int[ m_realSize ];
+        TRACE_GAME( "## Map\nSize: %d, offset: %d\n##\n", m_realSize, m_offset );
+        m_neighbors[ UP ] = -m_offset;
+        m_neighbors[ LEFT ] = -1;
+        m_neighbors[ RIGHT ] = 1;
+        m_neighbors[ DOWN ] = m_offset;
+        m_explorer.SetGoals( m_frontier.GetMembership() );
+        m_homeDistance.Reset( m_realSize );
     }
     ~Map()
     {
-        delete[] m_parents;
-        delete[] m_pathSize;
         m_map = 0;
     }
 
-    void Update();
+    enum ExplorationMode
+    {
+        NEAREST_FRONTIER = 0,
+        // trades distance for the unknown cells Kirk would see from there
+        INFORMATION_GAIN
+    };
+
+    enum PathMode
+    {
+        PLAIN = 0,
+        // jump point search, same lengths with fewer expansions in open rooms
+        JUMP_POINTS
+    };
+
+    void SetExplorationMode( ExplorationMode mode ) { m_explorationMode = mode; }
+    // how CalculateKnownPath expands cells
+    void SetPathMode( PathMode mode ) { m_pathMode = mode; }
+    // also run the plain known path search and count the lengths that differ
+    void SetCheckPaths( bool enabled ) { m_checkPaths = enabled; }
+    int GetPathMismatches() const { return m_pathMismatches; }
+    // cells expanded by CalculateKnownPath, included in GetNodesExpanded
+    unsigned long long GetKnownPathNodes() const { return m_knownPathNodes; }
+    // keep a distance field from the start over the known cells, so the
+    // alarm can be checked before triggering it
+    void SetHomeField( bool enabled ) { m_homeField = enabled; }
+    // rows holds height * ( width + 1 ) bytes, a '\n' after each row, and
+    // is only read during the call
+    void Update( int kirkRow, int kirkColumn, const char *rows );
+    bool HasStep() const { return !m_path.empty(); }
     Direction GetStep()
     {
         Direction direction = m_path.front();
         m_path.pop();
         return direction;
     }
+    // totals over every search run so far, D* included
+    unsigned long long GetNodesExpanded() const { return m_nodesExpanded + m_planner.GetNodesExpanded() + m_explorer.GetNodesExpanded(); }
+    unsigned long long GetQueuePushes() const { return m_queuePushes + m_planner.GetQueuePushes() + m_explorer.GetQueuePushes(); }
+    int GetSearches() const { return m_searches + m_planner.GetSearches() + m_explorer.GetSearches(); }
 
 private:
 
@@ -75,17 +769,77 @@ private:
         LEAVING
     } m_state;
 
-    struct Node
+    // Kirk sees the cells up to this far in both axes
+    static const int k_viewRadius = 2;
+    static const int k_maxGain = ( 2 * k_viewRadius + 1 ) * ( 2 * k_viewRadius + 1 );
+    // below this many candidates per thread the gains are counted inline
+    static const int k_candidatesPerThread = 512;
+
+    struct Candidate
     {
         int position;
-        int value;
+        int distance;
+        int gain;
 
-        bool operator<( const Node &other ) const { return value > other.value; }
+        // higher gain per step, then closer, then lower position
+        bool BetterThan( const Candidate &other ) const
+        {
+            long long score = ( long long ) gain * ( other.distance + 1 );
+            long long otherScore = ( long long ) other.gain * ( distance + 1 );
+            if ( score != otherScore ) return score > otherScore;
+            if ( distance != other.distance ) return distance < other.distance;
+            return position < other.position;
+        }
     };
 
-    void LookForControlRoom();
+    // adds the search work of this turn to the metrics counters
+    void ReportMetrics();
+    bool LookForControlRoom();
+    void LookForNearestUnknown();
+    bool LookForBestFrontier( int src );
+    int GetGain( int pos ) const;
+    // counts the gains of m_candidates and sorts them, best first
+    void ScoreCandidates();
+    void UpdateFrontier();
+    bool IsFrontier( int pos ) const;
     int GetNodeValue( const Point &position, const Point &target, int pathSize ) const;
     bool CalculatePath( const Point &target );
+    bool Walkable( int pos ) const
+    {
+        return pos >= 0 && pos < m_realSize && m_grid.Get( pos ) != PackedGrid::WALL;
+    }
+    // Same contract as CalculatePath for targets that stay fixed across
+    // turns, repairing the previous search instead of starting over
+    bool ReplanPath( const Point &target );
+    bool Known( int pos ) const { return Walkable( pos ) && m_grid.Get( pos ) != PackedGrid::UNKNOWN; }
+    int Distance( int pos1, int pos2 ) const
+    {
+        int y1 = pos1 / m_offset;
+        int y2 = pos2 / m_offset;
+        return std::abs( y1 - y2 ) + std::abs( ( pos1 - y1 * m_offset ) - ( pos2 - y2 * m_offset ) );
+    }
+    // Shortest path over known cells, searched from both ends until they
+    // meet. Fills m_path, false when the known cells don't connect them
+    bool CalculateKnownPath( int src, int dst );
+    bool SearchKnownPath( int src, int dst, bool jump );
+    // next known cell from pos going step by step where a shortest path may
+    // turn or where other was reached, -1 if there is none
+    int Jump( int pos, int step, const SearchWorkspace &other ) const;
+    // BFS from the start over the known cells, repaired each turn from the
+    // cells revealed, and the path down that field
+    void BuildHomeField();
+    void UpdateHomeField();
+    bool FollowHomeField( int src );
+    // length of the planned path, and its steps at the detail level
+    void TracePath() const;
+    // whether the known cells lead from pos to the start in at most steps
+    bool CanReturn( int pos, int steps ) const { return !m_homeField || m_homeDistance.Get( pos ) <= steps; }
+    int GetAlarmLeft() const { return m_alarmTurn < 0 ? m_alarmTimer : m_alarmTimer - ( m_turn - m_alarmTurn ); }
+    // Path from the control room to the start, preferring known cells
+    // unless a shorter way may go through unknown ones. The home field
+    // always reaches the control room, so CalculateKnownPath only runs here
+    // when the field is off
+    bool PlanWayBack();
     int CoordToPosition( int x, int y ) const { return y * m_offset + x; }
     void PositionToCoord( int &x, int &y, int pos ) const
     {
@@ -96,7 +850,7 @@ private:
     {
         Direction direction = UP;
         int diff = std::abs( pos1 - pos2 );
-        if ( diff == 1 )
+        if ( diff < m_offset )
         {
             direction = pos1 < pos2 ? RIGHT : LEFT;
         }
@@ -110,43 +864,95 @@ private:
     Point m_size;
     int m_realSize;
     int m_offset;
-    int *m_parents;
-    int *m_pathSize;
-    char *m_map;
+    int m_neighbors[ DSIZE ];
+    const char *m_map;
+    // cells that changed in the last Update
+    std::vector<int> m_changed;
 
     Point m_kirk;
     Point m_startPosition;
     Point m_controlRoom;
     std::queue<Direction> m_path;
+    // m_map classified, and as it was on the previous turn
+    PackedGrid m_grid;
+    PackedGrid m_lastGrid;
+    DStarLite m_planner;
+    // distance field from the frontier, only walks over known cells
+    FrontierSet m_frontier;
+    DStarLite m_explorer;
+    SearchWorkspace m_search;
+    // open set of the A*, keys are bounded by GetNodeValue, and of the half
+    // of CalculateKnownPath growing from the source, which LookForBestFrontier
+    // runs every turn while searching for the control room
+    BucketQueue m_openSet;
+    // the half of CalculateKnownPath growing from the target
+    SearchWorkspace m_backSearch;
+    BucketQueue m_backSet;
+    StampedArray m_homeDistance;
+    bool m_homeField;
+    int m_alarmTimer;
+    int m_turn;
+    // turn Kirk reached the control room
+    int m_alarmTurn;
+    ExplorationMode m_explorationMode;
+    PathMode m_pathMode;
+    bool m_checkPaths;
+    int m_pathMismatches;
+    unsigned long long m_knownPathNodes;
+    std::vector<Candidate> m_candidates;
+    WorkerPool m_pool;
+    unsigned long long m_nodesExpanded;
+    unsigned long long m_queuePushes;
+    int m_searches;
+    // totals already added to the metrics counters
+    unsigned long long m_reportedNodes;
+    unsigned long long m_reportedPushes;
+    int m_reportedSearches;
 };
 
-void Map::Update()
+void Map::Update( int kirkRow, int kirkColumn, const char *rows )
 {
-    scanf( "%d%d%*c", &m_kirk.y, &m_kirk.x );
-    fread( m_map, sizeof( char ), m_realSize, stdin );
+    METRICS_TIME( "labyrinth.update" );
+    m_map = rows;
+    m_kirk.SetPoint( kirkColumn, kirkRow );
+
+    m_lastGrid.Swap( m_grid );
+    m_grid.Classify( m_map );
+    m_changed.clear();
+    m_grid.Diff( m_lastGrid, m_changed );
+    UpdateFrontier();
+    m_planner.CellsChanged( m_changed );
+    m_explorer.CellsChanged( m_changed );
+    if ( m_homeField && m_state != START ) UpdateHomeField();
+    ++m_turn;
 
-    fprintf( stderr, "Kirk position: %d, %d (%d): '%c'\n", m_kirk.x, m_kirk.y, CoordToPosition( m_kirk.x, m_kirk.y ), m_map[ CoordToPosition( m_kirk.x, m_kirk.y ) ] );
-    fwrite( m_map, sizeof( char ), m_realSize, stderr );
+    TRACE_TURN( "Kirk position: %d, %d (%d): '%c'\n", m_kirk.x, m_kirk.y, CoordToPosition( m_kirk.x, m_kirk.y ), m_map[ CoordToPosition( m_kirk.x, m_kirk.y ) ] );
+#if TRACE_LEVEL >= TRACE_LEVEL_DETAIL
+    for ( int row = 0; row < m_size.y; ++row ) TRACE_DETAIL( "%.*s\n", m_size.x, m_map + row * m_offset );
+#endif
 
     switch ( m_state )
     {
     case START:
-        fprintf( stderr, "Initialize map\n" );
+        TRACE_TURN( "Initialize map\n" );
         m_startPosition.x = m_kirk.x;
         m_startPosition.y = m_kirk.y;
+        if ( m_homeField ) BuildHomeField();
 
         m_state = SEARCHING_CONTROL_ROOM;
 
     case SEARCHING_CONTROL_ROOM:
 
-        fprintf( stderr, "Looking for control room\n" );
+        TRACE_TURN( "Looking for control room\n" );
         if ( m_controlRoom.x < 0 )
         {
-            for ( int i = 0; i < m_realSize; ++i )
+            for ( int i = m_grid.FindSpecial( 0 ); i >= 0; i = m_grid.FindSpecial( i + 1 ) )
             {
                 if ( m_map[ i ] == 'C' )
                 {
                     PositionToCoord( m_controlRoom.x, m_controlRoom.y, i );
+                    // exploring must not step in by accident
+                    m_explorer.Block( i );
                     break;
                 }
             }
@@ -154,17 +960,23 @@ void Map::Update()
 
         if ( m_controlRoom.x < 0 )
         {
-            fprintf( stderr, "Control room not found\n" );
+            TRACE_TURN( "Control room not found\n" );
             // Still don't know where the control room is located
             LookForControlRoom();
         }
+        else if ( !CanReturn( CoordToPosition( m_controlRoom.x, m_controlRoom.y ), m_alarmTimer ) && LookForControlRoom() )
+        {
+            TRACE_TURN( "Control room found but the known way back is too long\n" );
+        }
         else
         {
-            fprintf( stderr, "Control room found\n" );
-            bool pathFound = CalculatePath( m_controlRoom );
+            TRACE_TURN( "Control room found\n" );
+            bool pathFound = ReplanPath( m_controlRoom );
             if ( pathFound )
             {
                 m_state = GOING_TO_CONTROL_ROOM;
+                // no more exploring, stop tracking changes
+                m_explorer.ClearGoal();
             }
         }
 
@@ -174,7 +986,8 @@ void Map::Update()
 
         if ( m_kirk == m_controlRoom )
         {
-            bool pathFound = CalculatePath( m_startPosition );
+            m_alarmTurn = m_turn;
+            bool pathFound = PlanWayBack();
             m_state = pathFound ? LEAVING : TRYING_TO_LEAVE;
         }
 
@@ -182,7 +995,11 @@ void Map::Update()
 
     case TRYING_TO_LEAVE:
 
-        if ( CalculatePath( m_startPosition ) )
+        if ( m_homeField && CanReturn( CoordToPosition( m_kirk.x, m_kirk.y ), GetAlarmLeft() ) && FollowHomeField( CoordToPosition( m_kirk.x, m_kirk.y ) ) )
+        {
+            m_state = LEAVING;
+        }
+        else if ( ReplanPath( m_startPosition ) )
         {
             m_state = LEAVING;
         }
@@ -192,20 +1009,140 @@ void Map::Update()
         break;
 
     }
+    ReportMetrics();
+}
+
+void Map::ReportMetrics()
+{
+    unsigned long long nodes = GetNodesExpanded();
+    unsigned long long pushes = GetQueuePushes();
+    int searches = GetSearches();
+    METRICS_ADD( "labyrinth.nodes_expanded", nodes - m_reportedNodes );
+    METRICS_ADD( "labyrinth.queue_pushes", pushes - m_reportedPushes );
+    METRICS_ADD( "labyrinth.searches", searches - m_reportedSearches );
+    m_reportedNodes = nodes;
+    m_reportedPushes = pushes;
+    m_reportedSearches = searches;
+}
+
+bool Map::LookForControlRoom()
+{
+    METRICS_TIME( "labyrinth.look_for_control_room" );
+    TRACE_TURN( "Trying to find control room (%d frontier cells, %d unknown)\n", ( int ) m_frontier.GetCells().size(), m_grid.CountUnknown() );
+    int src = CoordToPosition( m_kirk.x, m_kirk.y );
+    if ( m_frontier.Contains( src ) || !m_explorer.ComputePath( src ) )
+    {
+        // Kirk is already next to an unknown cell or the field has nothing to offer
+        LookForNearestUnknown();
+        return !m_path.empty();
+    }
+    // once C is known, exploring only shortens the way back, so the nearest frontier wins
+    if ( m_explorationMode == INFORMATION_GAIN && m_controlRoom.x < 0 ) return LookForBestFrontier( src );
+
+    // walk down the field to the nearest frontier cell
+    while ( !m_path.empty() ) m_path.pop();
+    int pos = src;
+    while ( !m_frontier.Contains( pos ) )
+    {
+        int next = m_explorer.GetNext( pos );
+        m_path.push( GetDirection( pos, next ) );
+        pos = next;
+    }
+    TRACE_TURN( "Nearest frontier cell: %d, %d steps away\n", pos, ( int ) m_path.size() );
+    return true;
+}
+
+bool Map::LookForBestFrontier( int src )
+{
+    // frontier cells further than this can't beat the nearest one
+    int limit = k_maxGain * ( m_explorer.GetDistance( src ) + 1 );
+
+    // scored at their Manhattan distance first, which is never longer than
+    // the walk
+    m_candidates.clear();
+    const std::vector<int> &cells = m_frontier.GetCells();
+    for ( size_t i = 0; i < cells.size(); ++i )
+    {
+        int distance = Distance( src, cells[ i ] );
+        if ( distance > limit ) continue;
+        Candidate candidate = { cells[ i ], distance, 0 };
+        m_candidates.push_back( candidate );
+    }
+    if ( m_candidates.empty() ) return false;
+    ScoreCandidates();
+
+    // walk the candidates best first until none left can beat the best walk
+    Candidate best = { -1, 0, -1 };
+    std::queue<Direction> bestPath;
+    int walks = 0;
+    for ( size_t i = 0; i < m_candidates.size() && m_candidates[ i ].BetterThan( best ); ++i )
+    {
+        Candidate candidate = m_candidates[ i ];
+        ++walks;
+        if ( !CalculateKnownPath( src, candidate.position ) ) continue;
+        candidate.distance = ( int ) m_path.size();
+        if ( candidate.BetterThan( best ) )
+        {
+            best = candidate;
+            bestPath.swap( m_path );
+        }
+    }
+    if ( best.position < 0 ) return false;
+
+    m_path.swap( bestPath );
+    TRACE_TURN( "Best frontier cell: %d, %d steps away, %d unknown cells in view (%d candidates, %d walks)\n",
+        best.position, best.distance, best.gain, ( int ) m_candidates.size(), walks );
+
+    return true;
+}
+
+int Map::GetGain( int pos ) const
+{
+    int x = 0;
+    int y = 0;
+    PositionToCoord( x, y, pos );
+    int gain = 0;
+    for ( int row = std::max( 0, y - k_viewRadius ); row <= std::min( m_size.y - 1, y + k_viewRadius ); ++row )
+    {
+        for ( int col = std::max( 0, x - k_viewRadius ); col <= std::min( m_size.x - 1, x + k_viewRadius ); ++col )
+        {
+            gain += m_grid.Get( CoordToPosition( col, row ) ) == PackedGrid::UNKNOWN;
+        }
+    }
+    return gain;
+}
+
+void Map::ScoreCandidates()
+{
+    int nCandidates = ( int ) m_candidates.size();
+    int nThreads = std::max( 1, std::min( WorkerPool::GetMaxThreads(), nCandidates / k_candidatesPerThread ) );
+
+    // contiguous slices, each thread only writes its own candidates
+    m_pool.Run( nThreads, [ & ]( int t )
+    {
+        for ( int i = nCandidates * t / nThreads; i < nCandidates * ( t + 1 ) / nThreads; ++i )
+        {
+            m_candidates[ i ].gain = GetGain( m_candidates[ i ].position );
+        }
+    } );
+
+    std::sort( m_candidates.begin(), m_candidates.end(), []( const Candidate &a, const Candidate &b ) { return a.BetterThan( b ); } );
 }
 
-void Map::LookForControlRoom()
+void Map::LookForNearestUnknown()
 {
-    fprintf( stderr, "Trying to find control room\n" );
+    ++m_searches;
+    TRACE_TURN( "Looking for the nearest unknown cell\n" );
     std::queue<int> nodes;
     bool pathFound = false;
     Point target( -1, -1 );
     Point currentPos(-1, -1);
 
-    for ( int i = 0; i < m_realSize; ++i ) m_parents[i] = -1;
+    m_search.NewSearch( m_realSize );
     int position = CoordToPosition( m_kirk.x, m_kirk.y );
-    m_parents[ position ] = position;
+    m_search.m_parents.Set( position, position );
     nodes.push( position );
+    ++m_queuePushes;
 
     int neighbors[ DSIZE ];
     neighbors[ UP ] = -m_offset;
@@ -217,12 +1154,12 @@ void Map::LookForControlRoom()
     {
         int pos = nodes.front();
         nodes.pop();
+        ++m_nodesExpanded;
 
-        int pathSize = m_pathSize[ pos ];
         for ( int d = UP; d < DSIZE; ++d )
         {
             int p = pos + neighbors[ d ];
-            if ( m_parents[ p ] < 0 )
+            if ( m_search.m_parents.Get( p ) < 0 )
             {
                 if ( m_map[ p ] == '?' )
                 {
@@ -232,24 +1169,55 @@ void Map::LookForControlRoom()
                 else if ( m_map[ p ] != '#' )
                 {
                     nodes.push( p );
-                    m_parents[ p ] = pos;
+                    ++m_queuePushes;
+                    m_search.m_parents.Set( p, pos );
                 }
             }
         }
     }
 
-    fprintf( stderr, "Nearest '?' found at (%d, %d) (%d)\n", target.x, target.y, CoordToPosition( target.x, target.y ) );
+    TRACE_TURN( "Nearest '?' found at (%d, %d) (%d)\n", target.x, target.y, CoordToPosition( target.x, target.y ) );
     PositionToCoord( currentPos.x, currentPos.y, CoordToPosition( target.x, target.y ) );
     CalculatePath( target );
 }
 
+bool Map::IsFrontier( int pos ) const
+{
+    PackedGrid::Cell cell = m_grid.Get( pos );
+    if ( cell == PackedGrid::WALL || cell == PackedGrid::UNKNOWN ) return false;
+
+    // the newline column keeps rows apart
+    for ( int d = UP; d < DSIZE; ++d )
+    {
+        int p = pos + m_neighbors[ d ];
+        if ( p >= 0 && p < m_realSize && m_grid.Get( p ) == PackedGrid::UNKNOWN ) return true;
+    }
+    return false;
+}
+
+void Map::UpdateFrontier()
+{
+    // a cell can only enter or leave the frontier when it or a neighbour changed
+    for ( size_t i = 0; i < m_changed.size(); ++i )
+    {
+        int cells[ DSIZE + 1 ] = { m_changed[ i ], m_changed[ i ] - m_offset, m_changed[ i ] - 1, m_changed[ i ] + 1, m_changed[ i ] + m_offset };
+        for ( int c = 0; c <= DSIZE; ++c )
+        {
+            int pos = cells[ c ];
+            if ( pos < 0 || pos >= m_realSize ) continue;
+            if ( IsFrontier( pos ) ) m_frontier.Insert( pos );
+            else m_frontier.Erase( pos );
+        }
+    }
+}
+
 int Map::GetNodeValue( const Point &position, const Point &target, int pathSize ) const
 {
     int value = -1;
     int pos = CoordToPosition( position.x, position.y );
     
     if ( position == target ) return 0;
-    if ( m_map[ pos ] != '#' &&  m_pathSize[ pos ] > pathSize + 1 && m_parents[ pos ] < 0 )
+    if ( m_map[ pos ] != '#' &&  m_search.m_pathSize.Get( pos ) > pathSize + 1 && m_search.m_parents.Get( pos ) < 0 )
     {
         // calculate euristic value
         value = std::abs( position.x - target.x ) + std::abs( position.y - target.y );
@@ -262,41 +1230,32 @@ int Map::GetNodeValue( const Point &position, const Point &target, int pathSize
 
 bool Map::CalculatePath( const Point &target )
 {
+    METRICS_TIME( "labyrinth.calculate_path" );
+    ++m_searches;
     bool found = false;
 
-    std::priority_queue < Node > nodeQueue;
-    Node node;
-    node.position = CoordToPosition( m_kirk.x, m_kirk.y );
-    node.value = 0;
-    nodeQueue.push( node );
+    m_openSet.Clear();
+    m_openSet.Push( CoordToPosition( m_kirk.x, m_kirk.y ), 0 );
+    ++m_queuePushes;
 
     int src = CoordToPosition( m_kirk.x, m_kirk.y );
     int dst = CoordToPosition( target.x, target.y );
 
-    for ( int i = 0; i < m_realSize; ++i ) m_parents[ i ] = -1;
-    m_parents[ src ] = src;
-    for ( int i = 0; i < m_realSize; ++i ) m_pathSize[ i ] = m_realSize;
-    m_pathSize[ src ] = 0;
+    m_search.NewSearch( m_realSize );
+    m_search.m_parents.Set( src, src );
+    m_search.m_pathSize.Set( src, 0 );
 
     Point point(-1, -1);
-    int neighbors[ DSIZE ];
-    neighbors[ UP ] = -m_offset;
-    neighbors[ LEFT ] = -1;
-    neighbors[ RIGHT ] = 1;
-    neighbors[ DOWN ] = m_offset;
 
-    fprintf( stderr, ">>\nStart calculating path\nKirk pos: %d\nTarget: %d\n>>\n", src, dst );
+    TRACE_TURN( ">>\nStart calculating path\nKirk pos: %d\nTarget: %d\n>>\n", src, dst );
 
     // find the shortest path to the target
-    while ( !nodeQueue.empty() )
+    while ( !m_openSet.Empty() )
     {
-        int pos = 0;
-        {
-            const Node &n = nodeQueue.top();
-            pos = n.position;
-            fprintf( stderr, "Node (pos = %d) expanded with value: %d\n", pos, n.value );
-            nodeQueue.pop();
-        }
+        int value = 0;
+        int pos = m_openSet.Pop( value );
+        ++m_nodesExpanded;
+        TRACE_DETAIL( "Node (pos = %d) expanded with value: %d\n", pos, value );
 
         if ( pos == dst )
         {
@@ -304,69 +1263,382 @@ bool Map::CalculatePath( const Point &target )
             break;
         }
 
-        int pathSize = m_pathSize[ pos ];
+        int pathSize = m_search.m_pathSize.Get( pos );
         for ( int d = UP; d < DSIZE; ++d )
         {
-            int p = pos + neighbors[ d ];
+            int p = pos + m_neighbors[ d ];
+            if ( !Walkable( p ) ) continue;
+
             PositionToCoord( point.x, point.y, p );
             int v = GetNodeValue( point, target, pathSize );
             if ( v >= 0 )
             {
-                m_parents[ p ] = pos;
-                m_pathSize[ p ] = pathSize + 1;
-                node.position = p;
-                node.value = v;
-
-                nodeQueue.push( node );
+                m_search.m_parents.Set( p, pos );
+                m_search.m_pathSize.Set( p, pathSize + 1 );
+                m_openSet.Push( p, v );
+                ++m_queuePushes;
             }
         }
     }
-    fprintf( stderr, "Path found\n" );
+
+    while ( !m_path.empty() ) m_path.pop();
+    if ( !found )
+    {
+        TRACE_TURN( "Target not reachable\n" );
+        return false;
+    }
+
+    TRACE_TURN( "Path found\n" );
     // retrieve the path found
     int pos = dst;
     std::stack < Direction > stepStack;
     while ( pos != src )
     {
         if ( m_map[ pos ] == '?' ) found = false;
-        int parent = m_parents[ pos ];
+        int parent = m_search.m_parents.Get( pos );
         Direction direction = GetDirection( parent, pos );
         stepStack.push( direction );
         pos = parent;
     }
-    fprintf( stderr, "Path calculated:\n##\n" );
+    while ( !stepStack.empty() )
+    {
+        m_path.push( stepStack.top() );
+        stepStack.pop();
+    }
+    TracePath();
+
+    return found;
+}
+
+bool Map::ReplanPath( const Point &target )
+{
+    METRICS_TIME( "labyrinth.replan_path" );
+    int src = CoordToPosition( m_kirk.x, m_kirk.y );
+    int dst = CoordToPosition( target.x, target.y );
+
+    if ( m_planner.GetGoal() != dst )
+    {
+        TRACE_TURN( "New D* Lite goal: %d\n", dst );
+        m_planner.SetGoal( dst );
+    }
+
     while ( !m_path.empty() ) m_path.pop();
+    if ( !m_planner.ComputePath( src ) )
+    {
+        TRACE_TURN( "Target %d unreachable\n", dst );
+        return false;
+    }
+
+    // follow the tree; only fully known paths count as found
+    bool found = true;
+    for ( int pos = src; pos != dst; )
+    {
+        int next = m_planner.GetNext( pos );
+        if ( m_map[ next ] == '?' ) found = false;
+        Direction direction = GetDirection( pos, next );
+        m_path.push( direction );
+        pos = next;
+    }
+    TracePath();
+
+    return found;
+}
+
+bool Map::CalculateKnownPath( int src, int dst )
+{
+    METRICS_TIME( "labyrinth.calculate_known_path" );
+    if ( !m_checkPaths ) return SearchKnownPath( src, dst, m_pathMode == JUMP_POINTS );
+
+    int length = SearchKnownPath( src, dst, false ) ? ( int ) m_path.size() : -1;
+    bool found = SearchKnownPath( src, dst, m_pathMode == JUMP_POINTS );
+    if ( ( found ? ( int ) m_path.size() : -1 ) != length )
+    {
+        ++m_pathMismatches;
+        TRACE_GAME( "Known path from %d to %d: length %d, plain search %d\n", src, dst, found ? ( int ) m_path.size() : -1, length );
+    }
+    return found;
+}
+
+int Map::Jump( int pos, int step, const SearchWorkspace &other ) const
+{
+    bool horizontal = step == 1 || step == -1;
+    while ( true )
+    {
+        pos += step;
+        if ( !Known( pos ) ) return -1;
+        // the halves can only meet on cells they both stop at
+        if ( other.m_pathSize.Get( pos ) < m_realSize ) return pos;
+
+        if ( horizontal )
+        {
+            // turning vertical is allowed anywhere along a horizontal run
+            if ( Jump( pos, -m_offset, other ) >= 0 || Jump( pos, m_offset, other ) >= 0 ) return pos;
+        }
+        else
+        {
+            // turning horizontal is only needed when the side cell couldn't be reached from behind
+            if ( Known( pos - 1 ) && !Known( pos - step - 1 ) ) return pos;
+            if ( Known( pos + 1 ) && !Known( pos - step + 1 ) ) return pos;
+        }
+    }
+}
+
+// With jump, each half only stops at jump points: shortest paths are taken
+// horizontal runs first, so a vertical run only turns at a wall corner.
+// Every cell costs the same, so the stop test on the keys still holds
+bool Map::SearchKnownPath( int src, int dst, bool jump )
+{
+    ++m_searches;
+    // side 0 grows from src, side 1 from dst
+    SearchWorkspace *search[ 2 ] = { &m_search, &m_backSearch };
+    BucketQueue *open[ 2 ] = { &m_openSet, &m_backSet };
+    int ends[ 2 ] = { src, dst };
+    for ( int side = 0; side < 2; ++side )
+    {
+        search[ side ]->NewSearch( m_realSize );
+        search[ side ]->m_parents.Set( ends[ side ], ends[ side ] );
+        search[ side ]->m_pathSize.Set( ends[ side ], 0 );
+        open[ side ]->Clear();
+        open[ side ]->Push( ends[ side ], Distance( src, dst ) );
+        ++m_queuePushes;
+    }
+
+    int best = src == dst ? 0 : m_realSize;
+    int meet = src == dst ? src : -1;
+    int expanded = 0;
+    while ( !open[ 0 ]->Empty() && !open[ 1 ]->Empty() )
+    {
+        // nothing left on either side can beat the best meeting point
+        if ( open[ 0 ]->TopKey() >= best || open[ 1 ]->TopKey() >= best ) break;
+
+        int side = open[ 0 ]->Size() <= open[ 1 ]->Size() ? 0 : 1;
+        int key = 0;
+        int pos = open[ side ]->Pop( key );
+        ++m_nodesExpanded;
+        ++m_knownPathNodes;
+        int pathSize = search[ side ]->m_pathSize.Get( pos );
+        int parent = search[ side ]->m_parents.Get( pos );
+        ++expanded;
+
+        for ( int d = UP; d < DSIZE; ++d )
+        {
+            int step = m_neighbors[ d ];
+            int p = pos + step;
+            int length = 1;
+            if ( jump )
+            {
+                if ( pos != ends[ side ] )
+                {
+                    // prune the directions a shortest path taken this way can't turn to
+                    bool vertical = std::abs( pos - parent ) >= m_offset;
+                    int back = vertical ? ( parent < pos ? -m_offset : m_offset ) : ( parent < pos ? -1 : 1 );
+                    if ( step == back ) continue;
+                    if ( vertical && step != -back && ( !Known( p ) || Known( p + back ) ) ) continue;
+                }
+                p = Jump( pos, step, *search[ 1 - side ] );
+                if ( p < 0 ) continue;
+                length = std::abs( p - pos ) / ( step == 1 || step == -1 ? 1 : m_offset );
+            }
+            if ( !Known( p ) || search[ side ]->m_pathSize.Get( p ) <= pathSize + length ) continue;
+
+            search[ side ]->m_parents.Set( p, pos );
+            search[ side ]->m_pathSize.Set( p, pathSize + length );
+            open[ side ]->Push( p, pathSize + length + Distance( p, ends[ 1 - side ] ) );
+            ++m_queuePushes;
+
+            int other = search[ 1 - side ]->m_pathSize.Get( p );
+            if ( other < m_realSize && pathSize + length + other < best )
+            {
+                best = pathSize + length + other;
+                meet = p;
+            }
+        }
+    }
+    TRACE_TURN( "Known path: %d nodes expanded, length %d\n", expanded, meet < 0 ? -1 : best );
+    if ( meet < 0 ) return false;
+
+    // jumps are unrolled cell by cell
+    while ( !m_path.empty() ) m_path.pop();
+    std::stack < Direction > stepStack;
+    for ( int pos = meet; pos != src; )
+    {
+        int parent = m_search.m_parents.Get( pos );
+        Direction direction = GetDirection( parent, pos );
+        for ( int p = parent; p != pos; p += m_neighbors[ direction ] ) stepStack.push( direction );
+        pos = parent;
+    }
     while ( !stepStack.empty() )
     {
-        fprintf( stderr, "%s ", directionStr[ stepStack.top() ] );
         m_path.push( stepStack.top() );
         stepStack.pop();
     }
-    fprintf( stderr, "\n##\n" );
+    for ( int pos = meet; pos != dst; )
+    {
+        int next = m_backSearch.m_parents.Get( pos );
+        Direction direction = GetDirection( pos, next );
+        for ( int p = pos; p != next; p += m_neighbors[ direction ] ) m_path.push( direction );
+        pos = next;
+    }
+
+    return true;
+}
 
+bool Map::PlanWayBack()
+{
+    int src = CoordToPosition( m_kirk.x, m_kirk.y );
+    int dst = CoordToPosition( m_startPosition.x, m_startPosition.y );
+    bool known = ( m_homeField && FollowHomeField( src ) ) || CalculateKnownPath( src, dst );
+    // a known path within the alarm is safe, and nothing can beat the Manhattan distance
+    if ( known && ( ( int ) m_path.size() <= GetAlarmLeft() || ( int ) m_path.size() == Distance( src, dst ) ) ) return true;
+
+    std::queue<Direction> knownPath;
+    knownPath.swap( m_path );
+    bool found = ReplanPath( m_startPosition );
+    if ( !found && known && ( int ) knownPath.size() <= m_planner.GetDistance( src ) )
+    {
+        m_path.swap( knownPath );
+        found = true;
+    }
     return found;
 }
 
+void Map::BuildHomeField()
+{
+    ++m_searches;
+    int start = CoordToPosition( m_startPosition.x, m_startPosition.y );
+    std::queue<int> nodes;
+    m_homeDistance.Reset( m_realSize );
+    m_homeDistance.Set( start, 0 );
+    nodes.push( start );
+    ++m_queuePushes;
+    while ( !nodes.empty() )
+    {
+        int pos = nodes.front();
+        nodes.pop();
+        ++m_nodesExpanded;
+        for ( int d = UP; d < DSIZE; ++d )
+        {
+            int p = pos + m_neighbors[ d ];
+            if ( Known( p ) && m_homeDistance.Get( p ) == m_realSize )
+            {
+                m_homeDistance.Set( p, m_homeDistance.Get( pos ) + 1 );
+                nodes.push( p );
+                ++m_queuePushes;
+            }
+        }
+    }
+}
+
+void Map::UpdateHomeField()
+{
+    ++m_searches;
+    // cells only ever become known, so distances can only shrink
+    std::queue<int> nodes;
+    for ( size_t i = 0; i < m_changed.size(); ++i )
+    {
+        int pos = m_changed[ i ];
+        if ( !Known( pos ) ) continue;
+        int distance = m_homeDistance.Get( pos );
+        for ( int d = UP; d < DSIZE; ++d )
+        {
+            int p = pos + m_neighbors[ d ];
+            if ( Known( p ) ) distance = std::min( distance, m_homeDistance.Get( p ) + 1 );
+        }
+        if ( distance < m_homeDistance.Get( pos ) )
+        {
+            m_homeDistance.Set( pos, distance );
+            nodes.push( pos );
+            ++m_queuePushes;
+        }
+    }
+
+    while ( !nodes.empty() )
+    {
+        int pos = nodes.front();
+        nodes.pop();
+        ++m_nodesExpanded;
+        int distance = m_homeDistance.Get( pos ) + 1;
+        for ( int d = UP; d < DSIZE; ++d )
+        {
+            int p = pos + m_neighbors[ d ];
+            if ( Known( p ) && distance < m_homeDistance.Get( p ) )
+            {
+                m_homeDistance.Set( p, distance );
+                nodes.push( p );
+                ++m_queuePushes;
+            }
+        }
+    }
+}
+
+bool Map::FollowHomeField( int src )
+{
+    // known cells never turn back into walls, so the field stays usable
+    if ( m_homeDistance.Get( src ) >= m_realSize ) return false;
+
+    while ( !m_path.empty() ) m_path.pop();
+    for ( int pos = src; m_homeDistance.Get( pos ) > 0; )
+    {
+        int d = UP;
+        while ( d < DSIZE && ( !Known( pos + m_neighbors[ d ] ) || m_homeDistance.Get( pos + m_neighbors[ d ] ) != m_homeDistance.Get( pos ) - 1 ) ) ++d;
+        if ( d == DSIZE )
+        {
+            // a broken field must not walk off the grid, the caller searches instead
+            TRACE_TURN( "Home field has no step down from %d\n", pos );
+            while ( !m_path.empty() ) m_path.pop();
+            return false;
+        }
+        m_path.push( ( Direction ) d );
+        pos += m_neighbors[ d ];
+    }
+    TRACE_TURN( "Way back read from the home field: %d steps\n", ( int ) m_path.size() );
+
+    return true;
+}
+
+void Map::TracePath() const
+{
+    TRACE_TURN( "Path calculated: %d steps\n", ( int ) m_path.size() );
+#if TRACE_LEVEL >= TRACE_LEVEL_DETAIL
+    std::queue<Direction> path( m_path );
+    std::string steps;
+    for ( ; !path.empty(); path.pop() )
+    {
+        steps += directionStr[ path.front() ];
+        steps += ' ';
+    }
+    TRACE_DETAIL( "##\n%s\n##\n", steps.c_str() );
+#endif
+}
+
+#ifndef LABYRINTH_NO_MAIN
 int main()
 {
+    InputReader input;
     int height;
     int width;
     int alarmTimer;
-    scanf( "%d%d%d", &height, &width, &alarmTimer );
-    fprintf( stderr, "H: %d, W: %d, A: %d\n", height, width, alarmTimer );
+    if ( !input.ReadInt( height ) || !input.ReadInt( width ) || !input.ReadInt( alarmTimer ) ) return 1;
+    TRACE_GAME( "H: %d, W: %d, A: %d\n", height, width, alarmTimer );
 
-    unsigned int size = height * width + height;
-    char *buffer = new char[ size + 1 ];
-    Map shipMap( buffer, width, height );
+    Map shipMap( width, height, alarmTimer );
 
     // game loop
-    while ( 1 )
+    int kirkRow;
+    int kirkColumn;
+    while ( input.ReadInt( kirkRow ) && input.ReadInt( kirkColumn ) )
     {
-        shipMap.Update();
+        // the rows are read in place, Map only looks at them during Update
+        const char *rows = input.ReadRows( height, width );
+        if ( rows == 0 ) break;
+        shipMap.Update( kirkRow, kirkColumn, rows );
         Direction nextDirection = shipMap.GetStep();
         const char *nextDirectionStr = directionStr[ nextDirection ];
         printf( "%s\n", nextDirectionStr );
+        fflush( stdout );
+        METRICS_TICK();
     }
 
-    delete[] buffer;
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
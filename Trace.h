@@ -0,0 +1,130 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+// Traces are picked at compile time: every TRACE_* macro above TRACE_LEVEL
+// expands to nothing, arguments included. Build with -DTRACE_LEVEL=<n>
+#define TRACE_LEVEL_OFF 0
+// once per game: sizes, setup
+#define TRACE_LEVEL_GAME 1
+// a few lines per turn: state, decisions, search totals
+#define TRACE_LEVEL_TURN 2
+// every node expanded, whole maps and plans
+#define TRACE_LEVEL_DETAIL 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_TURN
+#endif
+
+// Traces are also written to stderr as they happen unless built with
+// -DTRACE_ECHO=0; they are always kept in the ring below
+#ifndef TRACE_ECHO
+#define TRACE_ECHO 1
+#endif
+
+// The last k_lines traces, kept in memory so they can be dumped after the
+// fact. Writers never wait: each one takes a ticket, and a line is stamped
+// odd while it is written and even once done, so Dump skips lines that are
+// half written or were overwritten while it copied them
+class TraceRing
+{
+public:
+
+    static const int k_lineSize = 192;
+    static const unsigned long long k_lines = 1 << 12;
+
+    TraceRing() : m_next( 0 ), m_first( 0 )
+    {
+        for ( unsigned long long i = 0; i < k_lines; ++i ) m_lines[ i ].m_stamp.store( 0, std::memory_order_relaxed );
+    }
+
+    void Write( const char *format, va_list args )
+    {
+        unsigned long long ticket = m_next.fetch_add( 1, std::memory_order_relaxed );
+        Line &line = m_lines[ ticket & ( k_lines - 1 ) ];
+        line.m_stamp.store( 2 * ticket + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        vsnprintf( line.m_text, k_lineSize, format, args );
+        line.m_stamp.store( 2 * ticket + 2, std::memory_order_release );
+    }
+
+    // Oldest first. Lines cut at k_lineSize keep a '\n'
+    void Dump( FILE *file ) const
+    {
+        unsigned long long end = m_next.load( std::memory_order_acquire );
+        unsigned long long begin = std::max( end > k_lines ? end - k_lines : 0, m_first.load( std::memory_order_acquire ) );
+        char text[ k_lineSize + 1 ];
+        for ( unsigned long long ticket = begin; ticket < end; ++ticket )
+        {
+            const Line &line = m_lines[ ticket & ( k_lines - 1 ) ];
+            if ( line.m_stamp.load( std::memory_order_acquire ) != 2 * ticket + 2 ) continue;
+            std::memcpy( text, line.m_text, k_lineSize );
+            std::atomic_thread_fence( std::memory_order_acquire );
+            if ( line.m_stamp.load( std::memory_order_relaxed ) != 2 * ticket + 2 ) continue;
+
+            size_t length = strnlen( text, k_lineSize - 1 );
+            if ( length == 0 || text[ length - 1 ] != '\n' ) text[ length++ ] = '\n';
+            fwrite( text, sizeof( char ), length, file );
+        }
+    }
+
+    // Dump leaves out every line written so far
+    void Clear() { m_first.store( m_next.load( std::memory_order_acquire ), std::memory_order_release ); }
+
+private:
+
+    struct Line
+    {
+        std::atomic<unsigned long long> m_stamp;
+        char m_text[ k_lineSize ];
+    };
+
+    std::atomic<unsigned long long> m_next;
+    std::atomic<unsigned long long> m_first;
+    Line m_lines[ k_lines ];
+};
+
+inline TraceRing &GetTraceRing()
+{
+    static TraceRing ring;
+    return ring;
+}
+
+inline void TraceWrite( const char *format, ... )
+{
+    va_list args;
+    va_start( args, format );
+#if TRACE_ECHO
+    va_list echo;
+    va_copy( echo, args );
+    vfprintf( stderr, format, echo );
+    va_end( echo );
+#endif
+    GetTraceRing().Write( format, args );
+    va_end( args );
+}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_GAME
+#define TRACE_GAME( ... ) TraceWrite( __VA_ARGS__ )
+#else
+#define TRACE_GAME( ... ) ( ( void ) 0 )
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_TURN
+#define TRACE_TURN( ... ) TraceWrite( __VA_ARGS__ )
+#else
+#define TRACE_TURN( ... ) ( ( void ) 0 )
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_DETAIL
+#define TRACE_DETAIL( ... ) TraceWrite( __VA_ARGS__ )
+#else
+#define TRACE_DETAIL( ... ) ( ( void ) 0 )
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads kept alive between turns, so a solver can split its work
+// every turn without starting threads each time. Threads are started the
+// first time a Run needs them and joined by the destructor
+class WorkerPool
+{
+public:
+
+    WorkerPool() : m_work( 0 ), m_nThreads( 0 ), m_running( 0 ), m_generation( 0 ), m_stop( false ) {}
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for ( size_t t = 0; t < m_threads.size(); ++t ) m_threads[ t ].join();
+    }
+
+    // hardware threads, the calling one included
+    static int GetMaxThreads() { return std::max( 1, ( int ) std::thread::hardware_concurrency() ); }
+
+    // Calls work( t ) for every t in [0, nThreads), 0 on the calling thread,
+    // and returns once all of them have returned
+    void Run( int nThreads, const std::function<void( int )> &work )
+    {
+        if ( nThreads <= 1 )
+        {
+            work( 0 );
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while ( ( int ) m_threads.size() < nThreads - 1 )
+        {
+            m_threads.push_back( std::thread( &WorkerPool::Loop, this, ( int ) m_threads.size() + 1, m_generation ) );
+        }
+        m_work = &work;
+        m_nThreads = nThreads;
+        m_running = nThreads - 1;
+        ++m_generation;
+        lock.unlock();
+        m_wake.notify_all();
+
+        work( 0 );
+
+        lock.lock();
+        m_done.wait( lock, [ this ]() { return m_running == 0; } );
+        m_work = 0;
+    }
+
+private:
+
+    // threads above m_nThreads sit the run out
+    void Loop( int t, unsigned long long generation )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while ( true )
+        {
+            m_wake.wait( lock, [ & ]() { return m_stop || m_generation != generation; } );
+            if ( m_stop ) return;
+            generation = m_generation;
+            if ( t >= m_nThreads ) continue;
+
+            const std::function<void( int )> &work = *m_work;
+            lock.unlock();
+            work( t );
+            lock.lock();
+            if ( --m_running == 0 ) m_done.notify_one();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::vector<std::thread> m_threads;
+    const std::function<void( int )> *m_work;
+    int m_nThreads;
+    int m_running;
+    unsigned long long m_generation;
+    bool m_stop;
+};
+
+#endif
\ No newline at end of file